@@ -28,8 +28,8 @@ ISR(MemManage_Handler) {
 
 /* Set up - Runs once on power up*/
 void setup() { 
-  // Get start address for flash page 1030
-  flash1_addr = flash1.getPageAddress<uint32_t>(1030);
+  // Get start address for flash page 1030 (resolved at compile time; an out of range page fails to compile)
+  flash1_addr = PageRef<1030>::pointer<uint32_t>();
   
   // Read in value 'blinks'
   uint32_t val = flash1.read<uint32_t>(flash1_addr);
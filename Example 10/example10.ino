@@ -0,0 +1,33 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Counts boots with FlashCounter instead of erasing and rewriting a page on every boot (see Example 1).
+ *
+ * Each increment clears one bit of a pre-erased page with a single program command. A page holds
+ * FLASHCOUNTER_STEPS increments before the counter moves to its second page with one erase, so the
+ * pages are erased once every ~2000 boots instead of on every boot.
+ * *********************************************************************************************************/
+#include "FlashCounter.h"
+#include <Arduino.h>
+
+FlashTools flash1;                         // FlashTools object
+FlashCounter boots(flash1, 1900);          // Uses flash pages 1900 and 1901
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+
+  // Read the counter from flash and count this boot
+  if (boots.begin() != SUCCESS || boots.increment() != SUCCESS) {
+    SerialUSB.println("Error! Boot counter update was not successful.");
+  }
+}
+
+void loop() {
+  SerialUSB.print("Boots: ");
+  SerialUSB.print(boots.value());
+  SerialUSB.print(", increments per erase: ");
+  SerialUSB.println(FLASHCOUNTER_STEPS);
+
+  // Sleep for 10 seconds
+  delay(10000);
+}
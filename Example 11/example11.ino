@@ -0,0 +1,67 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Logs sensor samples to a FlashJournal ring spanning the whole of flash bank 1 (EFC1, pages 1024-2047, 256 KB).
+ *
+ * On boot the journal finds its newest record by binary search over the page sequence numbers, so mount
+ * time stays in microseconds however full the bank is. Each sample is then appended with one program
+ * command (two when a new page is started); once the bank is full the oldest page is overwritten.
+ * *********************************************************************************************************/
+#include "FlashJournal.h"
+#include <Arduino.h>
+
+typedef struct {
+  uint32_t time_ms;
+  uint16_t analog[4];
+} Sample;
+
+FlashTools flash1;                                                        // FlashTools object
+FlashJournal journal(flash1, IFLASH_NB_OF_PAGES, IFLASH_NB_OF_PAGES, sizeof(Sample));   // Flash bank 1: pages 1024-2047
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+
+  uint32_t start = micros();
+  uint32_t status = journal.mount();
+  uint32_t elapsed = micros() - start;
+
+  if (status != SUCCESS) {
+    SerialUSB.println("Error! Journal mount was not successful.");
+  }
+  SerialUSB.print("Mount: ");
+  SerialUSB.print(elapsed);
+  SerialUSB.print(" us, records: ");
+  SerialUSB.print(journal.count());
+  SerialUSB.print(" of ");
+  SerialUSB.println(journal.capacity());
+
+  // Print the newest record from the previous run
+  Sample last;
+  if (journal.count() > 0 && journal.read(journal.count() - 1, &last) == SUCCESS) {
+    SerialUSB.print("Last sample at ");
+    SerialUSB.print(last.time_ms);
+    SerialUSB.println(" ms");
+  }
+}
+
+void loop() {
+  Sample sample;
+  sample.time_ms = millis();
+  for (int i = 0; i < 4; ++i) {
+    sample.analog[i] = analogRead(A0 + i);
+  }
+
+  uint32_t start = micros();
+  if (journal.append(&sample) != SUCCESS) {
+    SerialUSB.println("Error! Journal append was not successful.");
+  }
+  uint32_t elapsed = micros() - start;
+
+  SerialUSB.print("Append: ");
+  SerialUSB.print(elapsed);
+  SerialUSB.print(" us, records: ");
+  SerialUSB.println(journal.count());
+
+  // Sample every second
+  delay(1000);
+}
@@ -0,0 +1,112 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Power-cut test of FlashTransaction: commits that change 3 pages at once are interrupted by a reset at
+ * random points, and every boot checks that the pages were recovered consistently and times the recovery.
+ *
+ * Each commit writes the same generation number to all 3 logical pages. A timer interrupt resets the chip
+ * after a random delay, usually while a shadow page or the commit record is being programmed. After the
+ * reset, mount() must recover either the old or the new generation on all 3 pages. The results are kept
+ * in the general purpose backup registers (GPBR), which survive resets but not power cycles.
+ * *********************************************************************************************************/
+#include "FlashTransaction.h"
+#include <Arduino.h>
+
+#define CUTS          (500u)      // Number of resets to inject
+#define MAX_DELAY_US  (30000u)    // Longest delay before a reset (a 3-page commit takes roughly 20 ms)
+
+typedef struct {
+  uint32_t generation;
+  uint32_t payload[63];
+} Page;
+
+FlashTools flash1;                                           // FlashTools object
+FlashTransaction txn(flash1, 2000, 16, 4);                   // 4 logical pages in pages 2000-2015 (flash bank 1)
+
+// Backup registers: resets injected, inconsistent recoveries, total and longest recovery time (us)
+#define CUT_COUNT     (GPBR->SYS_GPBR[0])
+#define BAD_COUNT     (GPBR->SYS_GPBR[1])
+#define TOTAL_US      (GPBR->SYS_GPBR[2])
+#define LONGEST_US    (GPBR->SYS_GPBR[3])
+
+// Timer interrupt: cut the power (processor and peripheral reset)
+void TC3_Handler() {
+  RSTC->RSTC_CR = RSTC_CR_KEY(0xA5) | RSTC_CR_PROCRST | RSTC_CR_PERRST;
+}
+
+// Reset after delay_us microseconds (TC1 channel 0, MCK/128)
+void armReset(uint32_t delay_us) {
+  pmc_set_writeprotect(false);
+  pmc_enable_periph_clk(ID_TC3);
+  TC_Configure(TC1, 0, TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | TC_CMR_TCCLKS_TIMER_CLOCK4);
+  TC_SetRC(TC1, 0, 1 + (uint32_t)((uint64_t)delay_us * (VARIANT_MCK / 128) / 1000000));
+  TC1->TC_CHANNEL[0].TC_IER = TC_IER_CPCS;
+  NVIC_EnableIRQ(TC3_IRQn);
+  TC_Start(TC1, 0);
+}
+
+void setup() {
+  SerialUSB.begin(9600);
+
+  // Recovery: mount and read the generation of each page
+  uint32_t start = micros();
+  uint32_t status = txn.mount();
+  uint32_t elapsed = micros() - start;
+
+  uint32_t generation[3];
+  for (uint32_t p = 0; p < 3; ++p) {
+    txn.read(p * sizeof(Page), &generation[p], sizeof(uint32_t));
+  }
+  bool consistent = status == SUCCESS && generation[0] == generation[1] && generation[1] == generation[2];
+
+  // Backup registers are cleared on power-up: start a new test run
+  bool first_boot = (CUT_COUNT == 0 && BAD_COUNT == 0 && TOTAL_US == 0);
+  if (!first_boot) {
+    if (!consistent) {
+      ++BAD_COUNT;
+    }
+    TOTAL_US += elapsed;
+    if (elapsed > LONGEST_US) {
+      LONGEST_US = elapsed;
+    }
+  }
+
+  if (CUT_COUNT >= CUTS) {
+    delay(5000);
+    SerialUSB.print("Resets injected: ");
+    SerialUSB.println(CUT_COUNT);
+    SerialUSB.print("Inconsistent recoveries: ");
+    SerialUSB.println(BAD_COUNT);
+    SerialUSB.print("Recovery time: average ");
+    SerialUSB.print(TOTAL_US / CUT_COUNT);
+    SerialUSB.print(" us, longest ");
+    SerialUSB.print(LONGEST_US);
+    SerialUSB.println(" us");
+    SerialUSB.print("Last commit: ");
+    SerialUSB.print(txn.commits());
+    SerialUSB.print(", generation ");
+    SerialUSB.println(generation[0]);
+    while (true);
+  }
+
+  // Inject the next reset, then commit until it happens
+  ++CUT_COUNT;
+  randomSeed(micros() ^ txn.commits() ^ CUT_COUNT);
+  armReset(random(MAX_DELAY_US));
+}
+
+void loop() {
+  Page page;
+  txn.read(0, &page, sizeof(Page));
+  ++page.generation;
+  for (uint32_t i = 0; i < 63; ++i) {
+    page.payload[i] = page.generation * (i + 1);
+  }
+
+  // Change pages 0-2 in one commit
+  FlashIovec iov[3] = {
+    { 0 * sizeof(Page), &page, sizeof(Page) },
+    { 1 * sizeof(Page), &page, sizeof(Page) },
+    { 2 * sizeof(Page), &page, sizeof(Page) }
+  };
+  txn.commit(iov, 3);
+}
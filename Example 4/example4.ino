@@ -232,9 +232,9 @@ void loop() {
         _print("Error! Dword array flash write was not successful.");
     }
     
-    /* Read from third flash address, one dword at a time, and save to read_numbers */
-    for (uint32_t idx {0}; idx < SIZE2; ++idx) {
-        read_numbers[idx] = flash1.read<uint32_t>(flash_addr3 + idx);
+    /* Read the whole array from third flash address into read_numbers */
+    if (flash1.readArray<uint32_t>(flash_addr3, read_numbers, SIZE2)) {
+        _println("Error! Dword array read from flash was not successful.");
     }
 #endif
 
@@ -0,0 +1,68 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Compares EFC command latency between the IAP command mode (ROM routine) and the direct command mode
+ * (EEFC_FCR written from RAM, EEFC_FSR polled with a timeout).
+ *
+ * Each command is timed with micros() and averaged over RUNS iterations. The page program test writes
+ * alternating data to flash page 1500 so no write is skipped as unchanged.
+ * *********************************************************************************************************/
+#include "FlashTools.h"
+#include <Arduino.h>
+
+#define RUNS 16
+
+FlashTools flash1;                  // FlashTools object
+uint32_t data[IFLASH_WORDS_PER_PAGE]; // One page of data to be written
+uint32_t *flash1_addr;              // Address of flash page 1500
+
+/* Average time in microseconds to read the flash descriptor of bank 1 */
+uint32_t timeDescriptor(void) {
+  uint32_t start = micros();
+  for (int i = 0; i < RUNS; ++i) {
+    flash1.refreshFlashDescriptor(IFLASH1_ADDR);
+  }
+  return (micros() - start) / RUNS;
+}
+
+/* Average time in microseconds to erase and program one page */
+uint32_t timePageWrite(void) {
+  uint32_t elapsed = 0;
+  for (int i = 0; i < RUNS; ++i) {
+    for (uint32_t w = 0; w < IFLASH_WORDS_PER_PAGE; ++w) {
+      data[w] = (i & 1) ? w : ~w;
+    }
+    uint32_t start = micros();
+    if (flash1.write<uint32_t>(flash1_addr, data, sizeof(data))) {
+      SerialUSB.println("Error! Page write was not successful.");
+    }
+    elapsed += micros() - start;
+  }
+  return elapsed / RUNS;
+}
+
+/* Print results for the current command mode */
+void runTests(const char *name) {
+  SerialUSB.print(name);
+  SerialUSB.print(" - GETD: ");
+  SerialUSB.print(timeDescriptor());
+  SerialUSB.print(" us, EWP: ");
+  SerialUSB.print(timePageWrite());
+  SerialUSB.println(" us");
+}
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+  flash1_addr = flash1.getPageAddress<uint32_t>(1500);
+}
+
+void loop() {
+  flash1.setCommandMode(CMD_MODE_IAP);
+  runTests("IAP mode   ");
+
+  flash1.setCommandMode(CMD_MODE_DIRECT);
+  runTests("Direct mode");
+
+  // Sleep for 10 seconds
+  delay(10000);
+}
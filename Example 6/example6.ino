@@ -0,0 +1,101 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Cycle benchmark of the burst word kernels (flashWordCopy, flashWordCompare, flashBlankCheck) against the
+ * scalar loops they replace: memcpy into a staging buffer followed by a word by word copy, and a word by word
+ * compare / blank check.
+ *
+ * Cycles are counted with the Cortex-M3 DWT cycle counter. All tests use one 256 byte page: flash page 1800
+ * as the source, and a RAM buffer as the destination. Misaligned tests read the source at a 1 byte offset.
+ * *********************************************************************************************************/
+#include "FlashTools.h"
+#include <Arduino.h>
+
+uint32_t staging[IFLASH_WORDS_PER_PAGE];   // Staging buffer used by the scalar copy
+uint32_t dest[IFLASH_WORDS_PER_PAGE];      // Copy destination
+uint8_t  unaligned[IFLASH_PAGE_SIZE + 4];  // Source buffer for misaligned tests
+volatile uint32_t sink;                    // Keeps results from being optimized away
+const uint32_t *page;                      // Address of flash page 1800
+FlashTools flash1;                         // FlashTools object
+
+/* Start / read the DWT cycle counter */
+void startCycles(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t cycles(void) {
+  return DWT->CYCCNT;
+}
+
+/* Scalar copy: byte copy to staging buffer, then word by word copy */
+void scalarCopy(uint32_t *dst, const void *src) {
+  memcpy(staging, src, IFLASH_PAGE_SIZE);
+  uint32_t *s = staging;
+  for (uint32_t i = 0; i < IFLASH_WORDS_PER_PAGE; ++i) {
+    *dst++ = *s++;
+  }
+}
+
+/* Scalar compare and blank check */
+uint32_t scalarCompare(const uint32_t *a, const uint32_t *b) {
+  uint32_t diff = 0;
+  for (uint32_t i = 0; i < IFLASH_WORDS_PER_PAGE; ++i) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff;
+}
+
+bool scalarBlank(const uint32_t *a) {
+  for (uint32_t i = 0; i < IFLASH_WORDS_PER_PAGE; ++i) {
+    if (a[i] != 0xFFFFFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Print one result line */
+void report(const char *name, uint32_t scalar, uint32_t burst) {
+  SerialUSB.print(name);
+  SerialUSB.print(" - scalar: ");
+  SerialUSB.print(scalar);
+  SerialUSB.print(" cycles, burst: ");
+  SerialUSB.print(burst);
+  SerialUSB.println(" cycles");
+}
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+  page = flash1.getPageAddress<uint32_t>(1800);
+  memcpy(unaligned + 1, page, IFLASH_PAGE_SIZE);
+  startCycles();
+}
+
+void loop() {
+  uint32_t start, scalar, burst;
+
+  // Aligned copy from flash
+  start = cycles(); scalarCopy(dest, page); scalar = cycles() - start;
+  start = cycles(); flashWordCopy(dest, page, IFLASH_WORDS_PER_PAGE); burst = cycles() - start;
+  report("Copy (aligned)   ", scalar, burst);
+
+  // Misaligned copy from RAM
+  start = cycles(); scalarCopy(dest, unaligned + 1); scalar = cycles() - start;
+  start = cycles(); flashWordCopy(dest, unaligned + 1, IFLASH_WORDS_PER_PAGE); burst = cycles() - start;
+  report("Copy (misaligned)", scalar, burst);
+
+  // Compare flash page against RAM copy
+  start = cycles(); sink = scalarCompare(page, dest); scalar = cycles() - start;
+  start = cycles(); sink = flashWordCompare(page, dest, IFLASH_WORDS_PER_PAGE); burst = cycles() - start;
+  report("Compare          ", scalar, burst);
+
+  // Blank check of the flash page
+  start = cycles(); sink = scalarBlank(page); scalar = cycles() - start;
+  start = cycles(); sink = flashBlankCheck(page, IFLASH_WORDS_PER_PAGE); burst = cycles() - start;
+  report("Blank check      ", scalar, burst);
+
+  // Sleep for 10 seconds
+  delay(10000);
+}
@@ -0,0 +1,76 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Shows the code fetch speed recovered by leaving the boot-time flash wait states in place.
+ *
+ * FlashTools only raises the flash wait states (FWS) around EFC commands, so a global FlashTools object no
+ * longer slows down every instruction fetch. This sketch times a branch-heavy workload running from flash
+ * with the boot-time FWS (what FlashTools now leaves in place) and with FWS = 6 (what the FlashTools
+ * constructor used to set for the object's whole lifetime).
+ * *********************************************************************************************************/
+#include "FlashTools.h"
+#include <Arduino.h>
+
+#define ITERATIONS 200000
+
+FlashTools flash1;          // Global FlashTools object, as in Example 1
+volatile uint32_t sink;     // Keeps results from being optimized away
+
+/* Branch-heavy workload so instruction fetches are not hidden by the flash prefetch buffer */
+__attribute__ ((noinline)) uint32_t workload(uint32_t n) {
+  uint32_t x = 2463534242u, acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    switch (x & 7) {
+      case 0:  acc += x;       break;
+      case 1:  acc ^= x >> 3;  break;
+      case 2:  acc -= x << 1;  break;
+      case 3:  acc += i;       break;
+      case 4:  acc ^= i << 2;  break;
+      case 5:  acc += x ^ i;   break;
+      case 6:  acc -= i >> 1;  break;
+      default: acc ^= x;       break;
+    }
+  }
+  return acc;
+}
+
+/* Time the workload in microseconds with the given Flash Mode Register values */
+uint32_t timeWorkload(uint32_t fmr0, uint32_t fmr1) {
+  EFC0->EEFC_FMR = fmr0;
+  EFC1->EEFC_FMR = fmr1;
+  uint32_t start = micros();
+  sink = workload(ITERATIONS);
+  return micros() - start;
+}
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+}
+
+void loop() {
+  // Boot-time Flash Mode Registers, left untouched by FlashTools
+  const uint32_t boot0 = EFC0->EEFC_FMR, boot1 = EFC1->EEFC_FMR;
+  const uint32_t fws6_0 = (boot0 & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+  const uint32_t fws6_1 = (boot1 & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+
+  uint32_t boot_time = timeWorkload(boot0, boot1);
+  uint32_t fws6_time = timeWorkload(fws6_0, fws6_1);
+
+  // Restore boot-time values
+  EFC0->EEFC_FMR = boot0;
+  EFC1->EEFC_FMR = boot1;
+
+  SerialUSB.print("Boot FWS (");
+  SerialUSB.print((boot0 & EEFC_FMR_FWS_Msk) >> EEFC_FMR_FWS_Pos);
+  SerialUSB.print("): ");
+  SerialUSB.print(boot_time);
+  SerialUSB.print(" us, FWS 6: ");
+  SerialUSB.print(fws6_time);
+  SerialUSB.print(" us, speedup: ");
+  SerialUSB.print((float)fws6_time / boot_time);
+  SerialUSB.println("x");
+
+  // Sleep for 10 seconds
+  delay(10000);
+}
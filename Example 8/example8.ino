@@ -0,0 +1,93 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Measures sequential and random flash read bandwidth for each flash wait state / access mode setting.
+ *
+ * For every wait state value from minWaitStates(SystemCoreClock) up to CHIP_FLASH_WAIT_STATE, and for both
+ * 128-bit and 64-bit access modes, this sketch reads a 64 KB block of IFLASH0 sequentially (word by word)
+ * and at pseudo-random word offsets, and prints the bandwidth in KB/s. It then repeats the measurement with
+ * the two profiles applied by tuneFlash(), so the right profile can be picked for code-fetch-heavy and
+ * data-read-heavy phases of an application.
+ * *********************************************************************************************************/
+#include "FlashTools.h"
+#include <Arduino.h>
+
+#define BLOCK_SIZE   0x10000u                   // Bytes read per pass
+#define BLOCK_WORDS  (BLOCK_SIZE / 4)
+#define PASSES       4
+
+FlashTools flash1;          // Uses EFC0 by default
+volatile uint32_t sink;     // Keeps results from being optimized away
+
+/* Read the block word by word in address order */
+__attribute__ ((noinline)) uint32_t readSequential(const volatile uint32_t *src) {
+  uint32_t acc = 0;
+  for (uint32_t i = 0; i < BLOCK_WORDS; ++i) {
+    acc += src[i];
+  }
+  return acc;
+}
+
+/* Read the same number of words at pseudo-random offsets inside the block */
+__attribute__ ((noinline)) uint32_t readRandom(const volatile uint32_t *src) {
+  uint32_t acc = 0, x = 2463534242u;
+  for (uint32_t i = 0; i < BLOCK_WORDS; ++i) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    acc += src[x & (BLOCK_WORDS - 1)];
+  }
+  return acc;
+}
+
+/* Bandwidth in KB/s of PASSES reads of the block with the given reader */
+uint32_t bandwidth(uint32_t (*reader)(const volatile uint32_t*)) {
+  const volatile uint32_t *src = reinterpret_cast<const volatile uint32_t*>(IFLASH0_ADDR);
+  uint32_t start = micros();
+  for (uint32_t p = 0; p < PASSES; ++p) {
+    sink = reader(src);
+  }
+  uint32_t elapsed = micros() - start;
+  return (uint32_t)((uint64_t)PASSES * BLOCK_SIZE * 1000000u / 1024u / (elapsed ? elapsed : 1));
+}
+
+void printResult(const char *label) {
+  uint32_t seq = bandwidth(readSequential);
+  uint32_t rnd = bandwidth(readRandom);
+  SerialUSB.print(label);
+  SerialUSB.print(" FWS ");
+  SerialUSB.print(flash1.getfws());
+  SerialUSB.print(flash1.getfam() == FLASH_ACCESS_MODE_64 ? ",  64-bit" : ", 128-bit");
+  SerialUSB.print(": sequential ");
+  SerialUSB.print(seq);
+  SerialUSB.print(" KB/s, random ");
+  SerialUSB.print(rnd);
+  SerialUSB.println(" KB/s");
+}
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+}
+
+void loop() {
+  SerialUSB.print("SystemCoreClock: ");
+  SerialUSB.print(SystemCoreClock);
+  SerialUSB.print(" Hz, minimum wait states: ");
+  SerialUSB.println(FlashTools::minWaitStates(SystemCoreClock));
+
+  // Sweep wait states and access modes on EFC0 (IFLASH0 holds the block being read)
+  for (uint32_t fws = FlashTools::minWaitStates(SystemCoreClock); fws <= CHIP_FLASH_WAIT_STATE; ++fws) {
+    flash1.setfws(fws);
+    flash1.setfam(FLASH_ACCESS_MODE_128);
+    printResult("  ");
+    flash1.setfam(FLASH_ACCESS_MODE_64);
+    printResult("  ");
+  }
+
+  // Profiles applied to both EFCs by tuneFlash()
+  flash1.tuneFlash(FLASH_PROFILE_DATA);
+  printResult("  Data profile:");
+  flash1.tuneFlash(FLASH_PROFILE_CODE);
+  printResult("  Code profile:");
+
+  // Sleep for 10 seconds
+  delay(10000);
+}
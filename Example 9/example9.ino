@@ -0,0 +1,64 @@
+/* **********************************************************************************************************
+ * FlashTools - Example program.
+ * Uses FlashKV, a log-structured key-value store, in place of fixed-page EEPROM emulation.
+ *
+ * A boot counter and a settings struct are kept in a store spanning 16 pages at the end of flash bank 1.
+ * Each update appends a record to erased flash instead of erasing a page, and old records are reclaimed
+ * one page at a time, so wear is spread over all 16 pages. compactStep() is called from loop() while
+ * idle so put() rarely has to compact.
+ * *********************************************************************************************************/
+#include "FlashKV.h"
+#include <Arduino.h>
+
+#define KEY_BOOTS     1
+#define KEY_SETTINGS  2
+
+typedef struct {
+  uint32_t blink_ms;
+  uint8_t  brightness;
+} Settings;
+
+FlashTools flash1;                                   // FlashTools object
+FlashKV store(flash1, 2048 - 16, 16);                // Pages 2032-2047
+
+void setup() {
+  SerialUSB.begin(9600);
+  delay(5000);
+
+  // Rebuild the index from flash (formats the pages on first use)
+  if (store.mount() != SUCCESS) {
+    SerialUSB.println("Error! Store mount was not successful.");
+    return;
+  }
+
+  // Count boots
+  uint32_t boots = 0;
+  store.get(KEY_BOOTS, &boots, sizeof(boots));
+  ++boots;
+  if (store.put(KEY_BOOTS, &boots, sizeof(boots)) != SUCCESS) {
+    SerialUSB.println("Error! Boot counter update was not successful.");
+  }
+
+  // Load settings, storing defaults if none are saved yet
+  Settings settings = {500, 128};
+  if (store.get(KEY_SETTINGS, &settings, sizeof(settings)) == INVALID) {
+    store.put(KEY_SETTINGS, &settings, sizeof(settings));
+  }
+
+  SerialUSB.print("Boots: ");
+  SerialUSB.print(boots);
+  SerialUSB.print(", blink: ");
+  SerialUSB.print(settings.blink_ms);
+  SerialUSB.print(" ms, keys: ");
+  SerialUSB.print(store.count());
+  SerialUSB.print(", free pages: ");
+  SerialUSB.println(store.freePages());
+}
+
+void loop() {
+  // Reclaim one page of obsolete records while idle
+  store.compactStep();
+
+  // Sleep for 10 seconds
+  delay(10000);
+}
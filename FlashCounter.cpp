@@ -0,0 +1,135 @@
+/* **************************************************************************************************************************************************************
+ * FlashCounter.cpp                                                                                                                                             *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashCounter is a non-volatile monotonic counter built on FlashTools. Each increment clears one more bit of an erased page with a single program         *
+ * (EFC_FCMD_WP) command and no erase; a page is only erased when all of its bits are used, giving about two thousand increments per erase.                *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#include "FlashCounter.h"
+
+/*
+ * Constructor: Set the pages of the counter. Call begin() before use.
+ *  flash_tools - FlashTools object used for flash writes
+ *  page_num    - First of the two flash pages used by the counter (0-2046)
+ */
+FlashCounter::FlashCounter(FlashTools &flash_tools, uint32_t page_num)
+    : flash(flash_tools), page_num(page_num), current(2), position(IFLASH_WORDS_PER_PAGE), count(0) {
+}
+
+/*
+ * begin: Reads the counter from flash. The current page is the one with a valid header and the higher base. Its
+ * increment words are cleared in order, so the first word with bits left is found by binary search and its
+ * cleared bits are counted with CLZ.
+ * Returns 0 if successful, invalid code if the pages are out of range, or Flash Status Register error flags
+ */
+uint32_t FlashCounter::begin(void) {
+    
+    if (!flashPageValid(page_num + 1)) {
+        return INVALID;
+    }
+    
+    /* The pages are read directly from flash: write back any data the page cache holds for them */
+    for (uint32_t p {0}; p < 2; ++p) {
+        uint32_t status {flash.flushPage(flashPageAddress(page_num + p))};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    current  = 2;
+    position = IFLASH_WORDS_PER_PAGE;
+    count    = 0;
+    
+    for (uint32_t p {0}; p < 2; ++p) {
+        const uint32_t *page {reinterpret_cast<const uint32_t *>(flashPageAddress(page_num + p))};
+        if (page[0] == ~page[1] && (current == 2 || page[0] > count)) {
+            current = p;
+            count   = page[0];
+        }
+    }
+    
+    if (current == 2) {
+        return SUCCESS;
+    }
+    
+    /* Binary search for the first word with bits left (words before it are 0) */
+    const uint32_t *page {reinterpret_cast<const uint32_t *>(flashPageAddress(page_num + current))};
+    uint32_t lo {FLASHCOUNTER_HEADER_WORDS}, hi {IFLASH_WORDS_PER_PAGE};
+    while (lo < hi) {
+        uint32_t mid {lo + (hi - lo) / 2};
+        if (page[mid] == 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    position = lo;
+    count   += 32 * (position - FLASHCOUNTER_HEADER_WORDS) + (position < IFLASH_WORDS_PER_PAGE ? __CLZ(page[position]) : 0);
+    return SUCCESS;
+}
+
+/*
+ * increment: Adds one to the counter by clearing the next bit of the current page with one program command.
+ * When the page is used up, the other page is started at the new value instead (one erase and write command).
+ * Returns 0 if successful or Flash Status Register error flags
+ */
+uint32_t FlashCounter::increment(void) {
+    
+    if (current == 2 || position == IFLASH_WORDS_PER_PAGE) {
+        return startpage(count + 1);
+    }
+    
+    /* Clear the most significant set bit; the cleared bits stay a leading run of zeros */
+    uint32_t addr {flashPageAddress(page_num + current) + position * IFLASH_WORD_SIZE};
+    uint32_t word {*reinterpret_cast<const uint32_t *>(addr) >> 1};
+    
+    uint32_t status {flash.write<uint32_t>(addr, &word, IFLASH_WORD_SIZE, false, false)};
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    ++count;
+    if (word == 0) {
+        ++position;
+    }
+    return SUCCESS;
+}
+
+/*
+ * value: Gets the counter value
+ */
+uint32_t FlashCounter::value(void) {
+    return count;
+}
+
+/*
+ * startpage: Erases the page not in use and writes its header with the given base value; the page becomes current
+ *  value - Base value of the page
+ * Returns 0 if successful or Flash Status Register error flags
+ */
+uint32_t FlashCounter::startpage(uint32_t value) {
+    
+    const uint32_t NEXT {current == 0 ? 1u : 0u};
+    uint32_t page[IFLASH_WORDS_PER_PAGE];
+    memset(page, 0xFF, sizeof(page));
+    page[0] = value;
+    page[1] = ~value;
+    
+    /* With the page cache enabled the erase and write is absorbed in RAM; flush it so the page is in flash */
+    uint32_t status {flash.write<uint32_t>(flashPageAddress(page_num + NEXT), page, IFLASH_PAGE_SIZE, true, false)};
+    if (status == SUCCESS) {
+        status = flash.flushPage(flashPageAddress(page_num + NEXT));
+    }
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    current  = NEXT;
+    position = FLASHCOUNTER_HEADER_WORDS;
+    count    = value;
+    return SUCCESS;
+}
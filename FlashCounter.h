@@ -0,0 +1,61 @@
+/* **************************************************************************************************************************************************************
+ * FlashCounter.h                                                                                                                                               *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashCounter is a non-volatile monotonic counter built on FlashTools. Each increment clears one more bit of an erased page with a single program         *
+ * (EFC_FCMD_WP) command and no erase; a page is only erased when all of its bits are used, giving about two thousand increments per erase.                *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#ifndef FlashCounter_h
+#define FlashCounter_h
+
+#include "FlashTools.h"
+
+/* ---------------- FlashCounter Definitions ---------------- */
+#define FLASHCOUNTER_HEADER_WORDS  (2u)                                                   /* Page header: base value, inverted base value */
+#define FLASHCOUNTER_STEPS         ((IFLASH_WORDS_PER_PAGE - FLASHCOUNTER_HEADER_WORDS) * 32)   /* Increments per page */
+
+/* ---------------- FlashCounter Class ---------------- */
+/* Uses two pages alternately. A page holds the counter value it was started at (base) and its inverse, followed by
+   increment words: bits are cleared from the most significant bit of the first word onward, so the page value is
+   base + 32 * (cleared words) + CLZ(first partly cleared word). When a page is used up the other page is erased and
+   started at the next value with one erase and write command; the page with the higher base is the current one.
+   A power loss during the switch leaves the old page, which still holds the last value. The pages are read directly
+   from flash; with the FlashTools page cache enabled, begin() and the page switch write the pages' cache lines back. */
+class FlashCounter {
+    
+    private:
+        FlashTools &flash;
+    
+        /* First of the two pages */
+        uint32_t page_num;
+    
+        /* Current page (0 or 1, or 2 before the first increment), index of its first word with bits left, and value */
+        uint32_t current;
+        uint32_t position;
+        uint32_t count;
+    
+        /* Start the other page at a value */
+        uint32_t startpage(uint32_t value);
+    
+        /* Counters cannot be copied */
+        FlashCounter(const FlashCounter &);
+        FlashCounter &operator=(const FlashCounter &);
+    
+    public:
+        /* Create a counter on flash pages page_num and page_num + 1 (0-2046) */
+        FlashCounter(FlashTools &flash_tools, uint32_t page_num);
+    
+        /* Read the counter from flash */
+        uint32_t begin(void);
+    
+        /* Add one to the counter */
+        uint32_t increment(void);
+    
+        /* Get the counter value */
+        uint32_t value(void);
+};
+
+#endif /* FlashCounter_h */
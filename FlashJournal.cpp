@@ -0,0 +1,240 @@
+/* **************************************************************************************************************************************************************
+ * FlashJournal.cpp                                                                                                                                             *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashJournal is a circular journal of fixed-size records (e.g. telemetry samples) over a range of flash pages, built on FlashTools. Appends take one      *
+ * program command; when the journal is full the oldest page is overwritten. On mount the newest page is found by binary search over the page sequence    *
+ * numbers, so mounting reads a handful of words even over a full flash bank.                                                                                 *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#include "FlashJournal.h"
+
+/*
+ * Constructor: Set the page range and record size of the journal. Call mount() before use.
+ *  flash_tools - FlashTools object used for flash writes
+ *  first_page  - First flash page of the journal (flash bank 0: 0-1023, flash bank 1: 1024-2047)
+ *  page_count  - Number of pages (at least 2)
+ *  record_size - Size of each record in bytes (1-FLASHJOURNAL_MAX_RECORD)
+ */
+FlashJournal::FlashJournal(FlashTools &flash_tools, uint32_t first_page, uint32_t page_count, uint32_t record_size)
+    : flash(flash_tools), first_page(first_page), page_count(page_count), record_size(record_size),
+      slot_size(FLASHJOURNAL_RECORD_HEADER + ((record_size + 3) & ~3u)),
+      slots_per_page((IFLASH_PAGE_SIZE - FLASHJOURNAL_PAGE_HEADER) / (FLASHJOURNAL_RECORD_HEADER + ((record_size + 3) & ~3u))),
+      oldest(0), newest(0), used_pages(0), newest_slots(0), newest_seq(0), mounted(false) {
+}
+
+/*
+ * mount: Finds the oldest and newest page and the next free slot without scanning the journal.
+ * Taking pages with no valid header as smaller than any sequence number, the pages holding a sequence number not
+ * less than page 0's form a prefix of the ring ending at the newest page, so it is found by binary search.
+ * The used slots of the newest page also form a prefix and are found the same way.
+ * Returns 0 if successful or invalid code on a bad page range or record size
+ */
+uint32_t FlashJournal::mount(void) {
+    
+    if (page_count < 2 || !flashPageValid(first_page) || page_count > IFLASH_TOTAL_PAGES - first_page
+        || record_size == 0 || record_size > FLASHJOURNAL_MAX_RECORD) {
+        return INVALID;
+    }
+    
+    mounted      = true;
+    oldest       = newest = 0;
+    used_pages   = 0;
+    newest_slots = 0;
+    newest_seq   = 0;
+    
+    /* Page 0 is started first and again after every wrap. If it has no valid header, it is either unused (empty
+       journal) or was being restarted after a wrap when power was lost (the last page is then the newest) */
+    uint32_t seq0, seq;
+    const bool PAGE0_VALID {pageseq(0, &seq0)};
+    if (!PAGE0_VALID) {
+        if (!pageseq(page_count - 1, &seq)) {
+            return SUCCESS;
+        }
+        newest = page_count - 1;
+    } else {
+        uint32_t lo {0}, hi {page_count - 1};
+        while (lo < hi) {
+            uint32_t mid {lo + (hi - lo + 1) / 2};
+            if (pageseq(mid, &seq) && seq >= seq0) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        newest = lo;
+    }
+    pageseq(newest, &newest_seq);
+    
+    /* With an interrupted restart of page 0, the journal starts at page 1. Otherwise, before the first wrap, it starts
+       at page 0; afterwards at the page following the newest one, or the page after that if the following page's
+       restart was interrupted */
+    if (!PAGE0_VALID) {
+        oldest = 1;
+    } else if (newest_seq < page_count) {
+        oldest = 0;
+    } else {
+        oldest = pageseq((newest + 1) % page_count, &seq) ? (newest + 1) % page_count : (newest + 2) % page_count;
+    }
+    used_pages = (newest + page_count - oldest) % page_count + 1;
+    
+    /* Binary search for the first erased slot of the newest page */
+    const uint32_t SLOTS {pageaddr(newest) + FLASHJOURNAL_PAGE_HEADER};
+    uint32_t lo {0}, hi {slots_per_page};
+    while (lo < hi) {
+        uint32_t mid {lo + (hi - lo) / 2};
+        if (*reinterpret_cast<const uint32_t *>(SLOTS + mid * slot_size) != 0xFFFFFFFF) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    newest_slots = lo;
+    
+    return SUCCESS;
+}
+
+/*
+ * clear: Erases the pages of the journal and starts it empty
+ * Returns 0 if successful, invalid code if not mounted, or Flash Status Register error flags
+ */
+uint32_t FlashJournal::clear(void) {
+    
+    if (!mounted) {
+        return INVALID;
+    }
+    
+    /* Erase pages; pages that are already erased are skipped by write() */
+    uint32_t erased[IFLASH_WORDS_PER_PAGE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (uint32_t p {0}; p < page_count; ++p) {
+        uint32_t status {flash.write<uint32_t>(pageaddr(p), erased, IFLASH_PAGE_SIZE, true, false)};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    oldest = newest = 0;
+    used_pages   = 0;
+    newest_slots = 0;
+    newest_seq   = 0;
+    return SUCCESS;
+}
+
+/*
+ * append: Appends a record. Takes one program command; when a new page is started (overwriting the oldest page once the
+ * journal is full), an erase and write command programs its header first, so that append takes two commands.
+ *  data - Record (record_size bytes)
+ * Returns 0 if successful, invalid code on bad arguments, or Flash Status Register error flags
+ */
+uint32_t FlashJournal::append(const void *data) {
+    
+    if (!mounted || data == NULL) {
+        return INVALID;
+    }
+    
+    uint32_t buffer[IFLASH_WORDS_PER_PAGE];
+    
+    /* Start the next page: erase it and program its header (erase and write command) */
+    if (used_pages == 0 || newest_slots == slots_per_page) {
+        
+        const uint32_t NEXT {used_pages == 0 ? 0 : (newest + 1) % page_count};
+        const uint32_t SEQ  {used_pages == 0 ? 0 : newest_seq + 1};
+        memset(buffer, 0xFF, sizeof(buffer));
+        buffer[0] = SEQ;
+        buffer[1] = ~SEQ;
+        
+        uint32_t status {flash.write<uint32_t>(pageaddr(NEXT), buffer, IFLASH_PAGE_SIZE, true, false)};
+        if (status != SUCCESS) {
+            return status;
+        }
+        
+        if (used_pages == page_count) {
+            oldest = (oldest + 1) % page_count;
+        } else {
+            ++used_pages;
+        }
+        newest       = NEXT;
+        newest_seq   = SEQ;
+        newest_slots = 0;
+    }
+    
+    /* Checksum word, then the record padded with erased bytes */
+    buffer[(slot_size / 4) - 1] = 0xFFFFFFFF;
+    buffer[0] = checksum(data);
+    memcpy(&buffer[1], data, record_size);
+    
+    uint32_t status {flash.write<uint32_t>(pageaddr(newest) + FLASHJOURNAL_PAGE_HEADER + newest_slots * slot_size,
+                                           buffer, slot_size, false, false)};
+    
+    /* The slot is used even if programming failed, since some of its words may be programmed */
+    ++newest_slots;
+    return status;
+}
+
+/*
+ * read: Copies a record
+ *  idx - Record index (0 = oldest record, count() - 1 = newest record)
+ *  dst - Destination buffer (record_size bytes)
+ * Returns 0 if successful, invalid code on bad arguments, or error code if the record is torn (checksum mismatch)
+ */
+uint32_t FlashJournal::read(uint32_t idx, void *dst) {
+    
+    if (!mounted || dst == NULL || idx >= count()) {
+        return INVALID;
+    }
+    
+    const uint32_t PAGE {(oldest + idx / slots_per_page) % page_count};
+    const uint32_t SLOT {pageaddr(PAGE) + FLASHJOURNAL_PAGE_HEADER + (idx % slots_per_page) * slot_size};
+    
+    if (*reinterpret_cast<const uint32_t *>(SLOT) != checksum(reinterpret_cast<const void *>(SLOT + FLASHJOURNAL_RECORD_HEADER))) {
+        return ERROR;
+    }
+    return flash.readBlock(SLOT + FLASHJOURNAL_RECORD_HEADER, dst, record_size);
+}
+
+/*
+ * count: Gets the number of records stored
+ */
+uint32_t FlashJournal::count(void) {
+    return used_pages == 0 ? 0 : (used_pages - 1) * slots_per_page + newest_slots;
+}
+
+/*
+ * capacity: Gets the number of records that can be stored before appends start overwriting the oldest page
+ */
+uint32_t FlashJournal::capacity(void) {
+    return page_count * slots_per_page;
+}
+
+/*
+ * pageaddr: Gets the flash address of a page of the ring
+ */
+uint32_t FlashJournal::pageaddr(uint32_t ring_page) {
+    return flashPageAddress(first_page + ring_page);
+}
+
+/*
+ * pageseq: Gets the sequence number of a page of the ring
+ * Returns false if the page has no valid header (erased, or its restart was interrupted)
+ */
+bool FlashJournal::pageseq(uint32_t ring_page, uint32_t *seq) {
+    const uint32_t *page_header {reinterpret_cast<const uint32_t *>(pageaddr(ring_page))};
+    *seq = page_header[0];
+    return page_header[0] == ~page_header[1];
+}
+
+/*
+ * checksum: FNV-1a hash of a record with bit 0 cleared
+ */
+uint32_t FlashJournal::checksum(const void *data) {
+    
+    uint32_t sum {2166136261u};
+    const uint8_t *byte {reinterpret_cast<const uint8_t *>(data)};
+    for (uint32_t i {0}; i < record_size; ++i) {
+        sum = (sum ^ byte[i]) * 16777619u;
+    }
+    return sum & ~1u;
+}
@@ -0,0 +1,77 @@
+/* **************************************************************************************************************************************************************
+ * FlashJournal.h                                                                                                                                               *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashJournal is a circular journal of fixed-size records (e.g. telemetry samples) over a range of flash pages, built on FlashTools. Appends take one         *
+ * program command (two when a page is started); when the journal is full the oldest page is overwritten. On mount the newest page is found by binary search    *
+ * over the page sequence numbers, so mounting reads a handful of words even over a full flash bank.                                                            *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#ifndef FlashJournal_h
+#define FlashJournal_h
+
+#include "FlashTools.h"
+
+/* ---------------- FlashJournal Definitions ---------------- */
+#define FLASHJOURNAL_PAGE_HEADER    (8u)                                                      /* Page header: sequence number, inverted sequence number */
+#define FLASHJOURNAL_RECORD_HEADER  (4u)                                                      /* Record header: checksum */
+#define FLASHJOURNAL_MAX_RECORD     (IFLASH_PAGE_SIZE - FLASHJOURNAL_PAGE_HEADER - FLASHJOURNAL_RECORD_HEADER)   /* Largest record in bytes */
+
+/* ---------------- FlashJournal Class ---------------- */
+/* Ring page p holds sequence numbers p, p + page_count, p + 2 * page_count, ... since pages are started in order
+   with one erase and write command that programs the header. Records are stored in slots after the header, each
+   a checksum word followed by the record padded to a word; a slot is programmed with one write command and no erase.
+   Reads go directly to flash; do not enable the FlashTools page cache over the journal's page range.            */
+class FlashJournal {
+    
+    private:
+        FlashTools &flash;
+    
+        /* Page range and record layout */
+        uint32_t first_page;
+        uint32_t page_count;
+        uint32_t record_size;
+        uint32_t slot_size;
+        uint32_t slots_per_page;
+    
+        /* Ring: oldest and newest page, pages in use, used slots of the newest page, sequence number of the newest page */
+        uint32_t oldest;
+        uint32_t newest;
+        uint32_t used_pages;
+        uint32_t newest_slots;
+        uint32_t newest_seq;
+        bool mounted;
+    
+        /* Flash address of a ring page / sequence number of a page (false if the page has no valid header) */
+        uint32_t pageaddr(uint32_t ring_page);
+        bool pageseq(uint32_t ring_page, uint32_t *seq);
+    
+        /* Record checksum (never 0xFFFFFFFF, so a programmed slot never reads as erased) */
+        uint32_t checksum(const void *data);
+    
+        /* Journals cannot be copied */
+        FlashJournal(const FlashJournal &);
+        FlashJournal &operator=(const FlashJournal &);
+    
+    public:
+        /* Create a journal of record_size byte records over page_count pages (at least 2) starting at first_page (0-2047) */
+        FlashJournal(FlashTools &flash_tools, uint32_t first_page, uint32_t page_count, uint32_t record_size);
+    
+        /* Find the newest record (binary search) / erase the page range and start empty */
+        uint32_t mount(void);
+        uint32_t clear(void);
+    
+        /* Append a record (record_size bytes) */
+        uint32_t append(const void *data);
+    
+        /* Copy record idx (0 = oldest) */
+        uint32_t read(uint32_t idx, void *dst);
+    
+        /* Number of records stored / records stored at most before the oldest page is overwritten */
+        uint32_t count(void);
+        uint32_t capacity(void);
+};
+
+#endif /* FlashJournal_h */
@@ -0,0 +1,510 @@
+/* **************************************************************************************************************************************************************
+ * FlashKV.cpp                                                                                                                                                  *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashKV is a log-structured key-value store built on FlashTools. Records are appended to erased pages of a configurable page range with program-only      *
+ * writes, so updating a value does not erase its page. A RAM hash index maps each key to its latest record, and obsolete records are reclaimed one page    *
+ * at a time by copying the live records of the oldest page to the end of the log. Pages are used as a ring, which spreads wear evenly over the range.      *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#include "FlashKV.h"
+
+/*
+ * Constructor: Set the page range of the store. Call mount() before use.
+ *  flash_tools - FlashTools object used for flash writes
+ *  first_page  - First flash page of the store (flash bank 0: 0-1023, flash bank 1: 1024-2047)
+ *  page_count  - Number of pages (at least 2; one page is kept free for compaction)
+ */
+FlashKV::FlashKV(FlashTools &flash_tools, uint32_t first_page, uint32_t page_count)
+    : flash(flash_tools), first_page(first_page), page_count(page_count),
+      head(0), tail(0), used_pages(0), tail_offset(IFLASH_PAGE_SIZE), tail_seq(0), mounted(false), key_count(0) {
+    
+    for (uint32_t i {0}; i < FLASHKV_INDEX_SIZE; ++i) {
+        index[i].key = FLASHKV_ERASED_KEY;
+    }
+}
+
+/*
+ * mount: Rebuilds the RAM index by replaying the log from the oldest page to the newest. If the page range holds
+ * no store, it is formatted. A record torn by a power loss fails its checksum and ends its page's records.
+ * Returns 0 if successful, invalid code on a bad page range, or error code if the index cannot hold all keys
+ */
+uint32_t FlashKV::mount(void) {
+    
+    if (!validrange()) {
+        return INVALID;
+    }
+    
+    mounted = false;
+    key_count = 0;
+    for (uint32_t i {0}; i < FLASHKV_INDEX_SIZE; ++i) {
+        index[i].key = FLASHKV_ERASED_KEY;
+    }
+    
+    /* Pages in use form one run of the ring: head has the lowest sequence number, tail the highest */
+    bool found {false};
+    uint32_t head_seq {0};
+    for (uint32_t p {0}; p < page_count; ++p) {
+        const uint32_t *page_header {reinterpret_cast<const uint32_t *>(pageaddr(p))};
+        if (page_header[0] != FLASHKV_MAGIC || page_header[1] == 0xFFFFFFFF) {
+            continue;
+        }
+        if (!found || page_header[1] < head_seq) {
+            head     = p;
+            head_seq = page_header[1];
+        }
+        if (!found || page_header[1] > tail_seq) {
+            tail     = p;
+            tail_seq = page_header[1];
+        }
+        found = true;
+    }
+    
+    if (!found) {
+        return format();
+    }
+    used_pages = (tail + page_count - head) % page_count + 1;
+    
+    /* Replay records in log order */
+    for (uint32_t i {0}; i < used_pages; ++i) {
+    
+        const uint32_t PAGE {(head + i) % page_count};
+        const uint32_t PAGE_END {pageaddr(PAGE) + IFLASH_PAGE_SIZE};
+        uint32_t addr {pageaddr(PAGE) + FLASHKV_PAGE_HEADER};
+    
+        for (uint32_t record_header, size; (size = parse(addr, PAGE_END, &record_header)) != 0; addr += size) {
+            uint16_t key {static_cast<uint16_t>(record_header & 0xFFFF)};
+            if ((record_header >> 24) == FLASHKV_RECORD_DELETE) {
+                indexremove(key);
+            } else if (!indexput(key, (record_header >> 16) & 0xFF, addr)) {
+                return ERROR;
+            }
+        }
+    
+        /* Appends continue after the last record, unless a torn record leaves programmed words behind it */
+        if (PAGE == tail) {
+            tail_offset = (PAGE_END - addr >= IFLASH_WORD_SIZE && *reinterpret_cast<const uint32_t *>(addr) == 0xFFFFFFFF)
+                          ? addr - pageaddr(PAGE) : IFLASH_PAGE_SIZE;
+        }
+    }
+    
+    mounted = true;
+    return SUCCESS;
+}
+
+/*
+ * format: Erases every page of the range and starts an empty store
+ * Returns 0 if successful, invalid code on a bad page range, or Flash Status Register error flags
+ */
+uint32_t FlashKV::format(void) {
+    
+    if (!validrange()) {
+        return INVALID;
+    }
+    
+    mounted = false;
+    key_count = 0;
+    for (uint32_t i {0}; i < FLASHKV_INDEX_SIZE; ++i) {
+        index[i].key = FLASHKV_ERASED_KEY;
+    }
+    
+    /* Erase pages; pages that are already erased are skipped by write() */
+    uint32_t erased[IFLASH_WORDS_PER_PAGE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (uint32_t p {0}; p < page_count; ++p) {
+        uint32_t status {flash.write<uint32_t>(pageaddr(p), erased, IFLASH_PAGE_SIZE, true, false)};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    head = tail = 0;
+    used_pages = 0;
+    tail_seq = 0;
+    
+    uint32_t status {openpage()};
+    mounted = status == SUCCESS;
+    return status;
+}
+
+/*
+ * put: Stores a value for a key by appending a record. Storing the value a key already holds writes nothing.
+ *  key    - Key (0-0xFFFE)
+ *  data   - Value
+ *  length - Size of value in bytes (0-FLASHKV_MAX_VALUE)
+ * Returns 0 if successful, invalid code on bad arguments, error code if the store or index is full,
+ * or Flash Status Register error flags
+ */
+uint32_t FlashKV::put(uint16_t key, const void *data, uint32_t length) {
+    
+    if (!mounted || key == FLASHKV_ERASED_KEY || length > FLASHKV_MAX_VALUE || (data == NULL && length != 0)) {
+        return INVALID;
+    }
+    
+    const IndexEntry &entry {index[slot(key)]};
+    if (entry.key == key && entry.length == length
+        && memcmp(reinterpret_cast<const void *>(entry.addr + FLASHKV_RECORD_HEADER), data, length) == 0) {
+        return SUCCESS;
+    } else if (entry.key != key && key_count >= FLASHKV_MAX_KEYS) {
+        return ERROR;
+    }
+    
+    uint32_t addr;
+    uint32_t status {makeroom(FLASHKV_RECORD_HEADER + ((length + 3) & ~3u))};
+    if (status == SUCCESS && (status = append(key, FLASHKV_RECORD_VALUE, data, length, &addr)) == SUCCESS) {
+        indexput(key, length, addr);
+    }
+    return status;
+}
+
+/*
+ * get: Copies the value of a key
+ *  key    - Key
+ *  dst    - Destination buffer
+ *  size   - Size of destination buffer in bytes
+ *  length - Optional. Size of the stored value in bytes
+ * Returns 0 if successful, invalid code if the key is not stored, or error code if dst is too small
+ */
+uint32_t FlashKV::get(uint16_t key, void *dst, uint32_t size, uint32_t *length) {
+    
+    uint32_t value_length;
+    const void *value {find(key, &value_length)};
+    if (value == NULL) {
+        return INVALID;
+    }
+    
+    if (length != NULL) {
+        *length = value_length;
+    }
+    if (value_length > size) {
+        return ERROR;
+    }
+    return flash.readBlock(reinterpret_cast<uint32_t>(value), dst, value_length);
+}
+
+/*
+ * remove: Removes a key by appending a delete record
+ *  key - Key
+ * Returns 0 if successful, invalid code if the key is not stored, error code if the store is full,
+ * or Flash Status Register error flags
+ */
+uint32_t FlashKV::remove(uint16_t key) {
+    
+    if (!contains(key)) {
+        return INVALID;
+    }
+    
+    uint32_t addr;
+    uint32_t status {makeroom(FLASHKV_RECORD_HEADER)};
+    if (status == SUCCESS && (status = append(key, FLASHKV_RECORD_DELETE, NULL, 0, &addr)) == SUCCESS) {
+        indexremove(key);
+    }
+    return status;
+}
+
+/*
+ * find: Gets a pointer to the value of a key in flash. The pointer stays valid until the key is updated or removed,
+ * or its page is compacted.
+ *  key    - Key
+ *  length - Optional. Size of the value in bytes
+ * Returns pointer to the value or NULL if the key is not stored
+ */
+const void *FlashKV::find(uint16_t key, uint32_t *length) {
+    
+    if (!mounted || key == FLASHKV_ERASED_KEY) {
+        return NULL;
+    }
+    
+    const IndexEntry &entry {index[slot(key)]};
+    if (entry.key != key) {
+        return NULL;
+    }
+    if (length != NULL) {
+        *length = entry.length;
+    }
+    return reinterpret_cast<const void *>(entry.addr + FLASHKV_RECORD_HEADER);
+}
+
+/*
+ * contains: Checks if a key is stored
+ */
+bool FlashKV::contains(uint16_t key) {
+    return find(key) != NULL;
+}
+
+/*
+ * compactStep: Reclaims the oldest page. Its live records (those the index points to) are appended to the end of
+ * the log, then the page is erased. Delete records are dropped: every older page has already been reclaimed, so no
+ * older value remains for them to hide. Can be called from idle time to keep put() from compacting.
+ * Returns 0 if successful (or nothing to reclaim), invalid code if not mounted, or Flash Status Register error flags
+ */
+uint32_t FlashKV::compactStep(void) {
+    
+    if (!mounted) {
+        return INVALID;
+    } else if (used_pages < 2) {
+        return SUCCESS;
+    }
+    
+    const uint32_t PAGE_END {pageaddr(head) + IFLASH_PAGE_SIZE};
+    uint32_t addr {pageaddr(head) + FLASHKV_PAGE_HEADER};
+    
+    for (uint32_t record_header, size; (size = parse(addr, PAGE_END, &record_header)) != 0; addr += size) {
+    
+        IndexEntry &entry {index[slot(static_cast<uint16_t>(record_header & 0xFFFF))]};
+        if ((record_header >> 24) != FLASHKV_RECORD_VALUE || entry.key != (record_header & 0xFFFF) || entry.addr != addr) {
+            continue;
+        }
+    
+        uint32_t new_addr;
+        uint32_t status {append(entry.key, FLASHKV_RECORD_VALUE, reinterpret_cast<const void *>(addr + FLASHKV_RECORD_HEADER),
+                                entry.length, &new_addr)};
+        if (status != SUCCESS) {
+            return status;
+        }
+        entry.addr = new_addr;
+    }
+    
+    return erasehead();
+}
+
+/*
+ * count: Gets the number of stored keys
+ */
+uint32_t FlashKV::count(void) {
+    return key_count;
+}
+
+/*
+ * freePages: Gets the number of erased pages in the ring
+ */
+uint32_t FlashKV::freePages(void) {
+    return page_count - used_pages;
+}
+
+/*
+ * hash: Gets the home index slot of a key (Fibonacci hashing: the top log2(FLASHKV_INDEX_SIZE) bits of the product)
+ */
+uint32_t FlashKV::hash(uint16_t key) {
+    return (key * 2654435761u) >> (32 - __builtin_ctz(FLASHKV_INDEX_SIZE));
+}
+
+/*
+ * slot: Finds the index slot holding a key, or the empty slot where its probe sequence ends.
+ * The index is never more than 75% full, so every probe sequence ends.
+ */
+uint32_t FlashKV::slot(uint16_t key) {
+    
+    uint32_t i {hash(key)};
+    while (index[i].key != key && index[i].key != FLASHKV_ERASED_KEY) {
+        i = (i + 1) & (FLASHKV_INDEX_SIZE - 1);
+    }
+    return i;
+}
+
+/*
+ * indexput: Inserts or updates the index entry of a key
+ * Returns false if the key is new and the index is full
+ */
+bool FlashKV::indexput(uint16_t key, uint16_t length, uint32_t addr) {
+    
+    IndexEntry &entry {index[slot(key)]};
+    if (entry.key != key) {
+        if (key_count >= FLASHKV_MAX_KEYS) {
+            return false;
+        }
+        entry.key = key;
+        ++key_count;
+    }
+    entry.length = length;
+    entry.addr   = addr;
+    return true;
+}
+
+/*
+ * indexremove: Removes the index entry of a key. Entries after it in the probe run are shifted back into the gap
+ * (backward shift deletion), so lookups need no deleted-slot markers.
+ */
+void FlashKV::indexremove(uint16_t key) {
+    
+    uint32_t gap {slot(key)};
+    if (index[gap].key != key) {
+        return;
+    }
+    
+    for (uint32_t i {(gap + 1) & (FLASHKV_INDEX_SIZE - 1)}; index[i].key != FLASHKV_ERASED_KEY; i = (i + 1) & (FLASHKV_INDEX_SIZE - 1)) {
+    
+        /* An entry can fill the gap if its home slot is not cyclically within (gap, i] */
+        uint32_t home {hash(index[i].key)};
+        if (((i - home) & (FLASHKV_INDEX_SIZE - 1)) >= ((i - gap) & (FLASHKV_INDEX_SIZE - 1))) {
+            index[gap] = index[i];
+            gap = i;
+        }
+    }
+    
+    index[gap].key = FLASHKV_ERASED_KEY;
+    --key_count;
+}
+
+/*
+ * pageaddr: Gets the flash address of a page of the ring
+ */
+uint32_t FlashKV::pageaddr(uint32_t ring_page) {
+    return flashPageAddress(first_page + ring_page);
+}
+
+/*
+ * openpage: Starts the next page of the ring as the tail page. The page is erased and its header programmed
+ * with one erase and write command.
+ * Returns 0 if successful, error code if no page is free, or Flash Status Register error flags
+ */
+uint32_t FlashKV::openpage(void) {
+    
+    if (used_pages == page_count) {
+        return ERROR;
+    }
+    
+    const uint32_t NEXT {used_pages == 0 ? head : (tail + 1) % page_count};
+    uint32_t page[IFLASH_WORDS_PER_PAGE];
+    memset(page, 0xFF, sizeof(page));
+    page[0] = FLASHKV_MAGIC;
+    page[1] = tail_seq + 1;
+    
+    uint32_t status {flash.write<uint32_t>(pageaddr(NEXT), page, IFLASH_PAGE_SIZE, true, false)};
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    tail = NEXT;
+    ++tail_seq;
+    ++used_pages;
+    tail_offset = FLASHKV_PAGE_HEADER;
+    return SUCCESS;
+}
+
+/*
+ * erasehead: Erases the oldest page of the ring and frees it
+ * Returns 0 if successful or Flash Status Register error flags
+ */
+uint32_t FlashKV::erasehead(void) {
+    
+    uint32_t page[IFLASH_WORDS_PER_PAGE];
+    memset(page, 0xFF, sizeof(page));
+    
+    uint32_t status {flash.write<uint32_t>(pageaddr(head), page, IFLASH_PAGE_SIZE, true, false)};
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    head = (head + 1) % page_count;
+    --used_pages;
+    return SUCCESS;
+}
+
+/*
+ * validrange: Checks that the page range lies within flash and has at least 2 pages
+ */
+bool FlashKV::validrange(void) {
+    return page_count >= 2 && flashPageValid(first_page) && page_count <= IFLASH_TOTAL_PAGES - first_page;
+}
+
+/*
+ * makeroom: Compacts the oldest pages until a record of size bytes fits in the tail page, or a new page can be
+ * opened while still keeping one free page for compaction
+ *  size - Record size in bytes
+ * Returns 0 if successful, error code if the store is full of live records, or Flash Status Register error flags
+ */
+uint32_t FlashKV::makeroom(uint32_t size) {
+    
+    for (uint32_t steps {0}; tail_offset + size > IFLASH_PAGE_SIZE && freePages() < 2; ++steps) {
+        if (steps == page_count) {
+            return ERROR;
+        }
+        uint32_t status {compactStep()};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+ * append: Programs a record at the end of the log without erasing. Opens a new tail page if the record does not fit.
+ *  key    - Key
+ *  type   - FLASHKV_RECORD_VALUE or FLASHKV_RECORD_DELETE
+ *  data   - Value
+ *  length - Size of value in bytes
+ *  addr   - Flash address of the programmed record
+ * Returns 0 if successful, error code if no page is free, or Flash Status Register error flags
+ */
+uint32_t FlashKV::append(uint16_t key, uint32_t type, const void *data, uint32_t length, uint32_t *addr) {
+    
+    const uint32_t SIZE {FLASHKV_RECORD_HEADER + ((length + 3) & ~3u)};
+    if (tail_offset + SIZE > IFLASH_PAGE_SIZE) {
+        uint32_t status {openpage()};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    /* Header, checksum and value padded with erased bytes */
+    uint32_t record[(FLASHKV_RECORD_HEADER + FLASHKV_MAX_VALUE + 3) / 4];
+    record[(SIZE / 4) - 1] = 0xFFFFFFFF;
+    record[0] = key | (length << 16) | (type << 24);
+    record[1] = checksum(record[0], data, length);
+    if (length != 0) {
+        memcpy(&record[2], data, length);
+    }
+    
+    *addr = pageaddr(tail) + tail_offset;
+    uint32_t status {flash.write<uint32_t>(*addr, record, SIZE, false, false)};
+    
+    /* A failed program may leave some words programmed; later records start on a new page */
+    tail_offset = status == SUCCESS ? tail_offset + SIZE : IFLASH_PAGE_SIZE;
+    return status;
+}
+
+/*
+ * parse: Validates the record at addr
+ *  addr     - Flash address of the record
+ *  page_end - Flash address of the end of its page
+ *  header   - Record header word output
+ * Returns the record size in bytes, or 0 if addr holds erased flash, a torn record or the end of the page
+ */
+uint32_t FlashKV::parse(uint32_t addr, uint32_t page_end, uint32_t *header) {
+    
+    if (page_end - addr < FLASHKV_RECORD_HEADER) {
+        return 0;
+    }
+    
+    const uint32_t *record {reinterpret_cast<const uint32_t *>(addr)};
+    const uint32_t LENGTH {(record[0] >> 16) & 0xFF};
+    const uint32_t TYPE   {record[0] >> 24};
+    const uint32_t SIZE   {FLASHKV_RECORD_HEADER + ((LENGTH + 3) & ~3u)};
+    
+    if (record[0] == 0xFFFFFFFF || (record[0] & 0xFFFF) == FLASHKV_ERASED_KEY
+        || (TYPE != FLASHKV_RECORD_VALUE && TYPE != FLASHKV_RECORD_DELETE) || SIZE > page_end - addr
+        || record[1] != checksum(record[0], &record[2], LENGTH)) {
+        return 0;
+    }
+    
+    *header = record[0];
+    return SIZE;
+}
+
+/*
+ * checksum: FNV-1a hash of a record header word and value
+ */
+uint32_t FlashKV::checksum(uint32_t header, const void *data, uint32_t length) {
+    
+    uint32_t sum {2166136261u};
+    for (uint32_t i {0}; i < 4; ++i) {
+        sum = (sum ^ ((header >> (8 * i)) & 0xFF)) * 16777619u;
+    }
+    for (const uint8_t *byte {reinterpret_cast<const uint8_t *>(data)}; length > 0; --length) {
+        sum = (sum ^ *byte++) * 16777619u;
+    }
+    return sum;
+}
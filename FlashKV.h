@@ -0,0 +1,114 @@
+/* **************************************************************************************************************************************************************
+ * FlashKV.h                                                                                                                                                    *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashKV is a log-structured key-value store built on FlashTools. Records are appended to erased pages of a configurable page range with program-only      *
+ * writes, so updating a value does not erase its page. A RAM hash index maps each key to its latest record, and obsolete records are reclaimed one page    *
+ * at a time by copying the live records of the oldest page to the end of the log. Pages are used as a ring, which spreads wear evenly over the range.      *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#ifndef FlashKV_h
+#define FlashKV_h
+
+#include "FlashTools.h"
+
+/* ---------------- FlashKV Definitions ---------------- */
+#ifndef FLASHKV_INDEX_SIZE
+#define FLASHKV_INDEX_SIZE      (128u)                                   /* Index slots (power of 2) */
+#endif
+#define FLASHKV_MAX_KEYS        (FLASHKV_INDEX_SIZE - FLASHKV_INDEX_SIZE / 4)    /* Keys kept at most (75% load) */
+#define FLASHKV_MAGIC           (0x4B564C31u)                            /* Page header magic ("1LVK") */
+#define FLASHKV_PAGE_HEADER     (8u)                                     /* Page header: magic, sequence number */
+#define FLASHKV_RECORD_HEADER   (8u)                                     /* Record header: key/length/type, checksum */
+#define FLASHKV_MAX_VALUE       (IFLASH_PAGE_SIZE - FLASHKV_PAGE_HEADER - FLASHKV_RECORD_HEADER)   /* Largest value in bytes */
+#define FLASHKV_ERASED_KEY      (0xFFFFu)                                /* Reserved key (erased flash / empty slot) */
+
+/* ---------------- FlashKV Record Types ---------------- */
+#define FLASHKV_RECORD_VALUE    (0x01u)                                  /* Key holds the record's value */
+#define FLASHKV_RECORD_DELETE   (0x02u)                                  /* Key was removed (tombstone) */
+
+/* ---------------- FlashKV Class ---------------- */
+/* Page layout: magic, sequence number, then records. Records never cross pages; each record is
+   key (bits 0-15) | length (bits 16-23) | type (bits 24-31), checksum, value padded to a word with 0xFF.
+   Reads go directly to flash; do not enable the FlashTools page cache over the store's page range.     */
+class FlashKV {
+    
+    private:
+        FlashTools &flash;
+    
+        /* Page range of the store */
+        uint32_t first_page;
+        uint32_t page_count;
+    
+        /* Log ring: oldest page, page being appended to (indices into the range), pages in use, next free offset
+           in the tail page and sequence number of the tail page */
+        uint32_t head;
+        uint32_t tail;
+        uint32_t used_pages;
+        uint32_t tail_offset;
+        uint32_t tail_seq;
+        bool mounted;
+    
+        /* Open-addressing (linear probing) index: key and flash address of its latest record */
+        typedef struct {
+            uint16_t key;
+            uint16_t length;
+            uint32_t addr;
+        } IndexEntry;
+        IndexEntry index[FLASHKV_INDEX_SIZE];
+        uint32_t key_count;
+    
+        /* Index helpers: home slot of key, find slot of key (or the empty slot ending its probe), insert/update, remove */
+        static uint32_t hash(uint16_t key);
+        uint32_t slot(uint16_t key);
+        bool indexput(uint16_t key, uint16_t length, uint32_t addr);
+        void indexremove(uint16_t key);
+    
+        /* Page helpers: flash address of a ring page, start a new tail page, erase the head page */
+        uint32_t pageaddr(uint32_t ring_page);
+        uint32_t openpage(void);
+        uint32_t erasehead(void);
+    
+        /* Check the page range / compact until a record of size bytes can be appended while keeping a spare page */
+        bool validrange(void);
+        uint32_t makeroom(uint32_t size);
+    
+        /* Append a record to the tail page; opens a new page if needed. Returns the record address in *addr */
+        uint32_t append(uint16_t key, uint32_t type, const void *data, uint32_t length, uint32_t *addr);
+    
+        /* Parse the record at addr within a page. Returns its size in bytes, or 0 at the end of the page's records */
+        static uint32_t parse(uint32_t addr, uint32_t page_end, uint32_t *header);
+        static uint32_t checksum(uint32_t header, const void *data, uint32_t length);
+    
+        /* Stores cannot be copied */
+        FlashKV(const FlashKV &);
+        FlashKV &operator=(const FlashKV &);
+    
+    public:
+        /* Create a store over page_count pages (at least 2) starting at flash page first_page (0-2047) */
+        FlashKV(FlashTools &flash_tools, uint32_t first_page, uint32_t page_count);
+    
+        /* Rebuild the index from flash (formats the range if it holds no store) / erase the range and start empty */
+        uint32_t mount(void);
+        uint32_t format(void);
+    
+        /* Set / get / remove a value */
+        uint32_t put(uint16_t key, const void *data, uint32_t length);
+        uint32_t get(uint16_t key, void *dst, uint32_t size, uint32_t *length = NULL);
+        uint32_t remove(uint16_t key);
+    
+        /* Get a pointer to the value in flash (no copy) and its length; NULL if the key is not stored */
+        const void *find(uint16_t key, uint32_t *length = NULL);
+        bool contains(uint16_t key);
+    
+        /* Reclaim the oldest page: copy its live records to the end of the log and erase it */
+        uint32_t compactStep(void);
+    
+        /* Number of stored keys / free pages */
+        uint32_t count(void);
+        uint32_t freePages(void);
+};
+
+#endif /* FlashKV_h */
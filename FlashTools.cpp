@@ -17,13 +17,22 @@
 /*** Function pointer for IAP routine ***/
 FlashTools::IAP_FPTR FlashTools::IAP = NULL;
 
+/*** Asynchronous write queue ***/
+FlashTools::AsyncJob FlashTools::async_queue[FLASH_ASYNC_QUEUE_DEPTH];
+volatile uint32_t FlashTools::async_head = 0;
+volatile uint32_t FlashTools::async_tail = 0;
+volatile bool FlashTools::async_in_handler = false;
+FlashAsyncStats FlashTools::async_stats = {};
+EfcInstance *FlashTools::async_efc = NULL;
+uint32_t FlashTools::async_fws = 0;
+
 /*
- * Constructor: Initialize IAP function and EFC controllers.
- * Save flash access mode and flash wait state values.
+ * Constructor: Initialize IAP function and EFC instances.
+ * The Flash Mode Registers are left as configured at boot; wait states are only raised around EFC commands.
  */
 __attribute__ ((noinline, section(".ramfunc"))) FlashTools::FlashTools(void) {
-    /* Set EFC, MPU, and SCB instances */
-    efc = EFC0;
+    /* Set EFC instances and flash, then MPU and SCB instances */
+    init(EFC0, EFC1, reinterpret_cast<uint8_t *>(IFLASH_ADDR));
     mpu = ((MpuInstance*)MPU_ADDR);
     scb = ((ScbInstance*)SCB_ADDR);
     
@@ -32,35 +41,70 @@ __attribute__ ((noinline, section(".ramfunc"))) FlashTools::FlashTools(void) {
     
     /* Retrieve IAP function entry by reading NMI vector in ROM (address 0x00100008) */
     IAP = (uint32_t(*)(uint32_t EFCidx, uint32_t cmd)) *((uint32_t *)IAP_ENTRY_ADDRESS);
+}
+
+/*
+ * Constructor: Host testing instance. write(), writev(), lock(), unlock() and the lock bit cache drive the given EFC
+ * register blocks and flash image (an emulated EFC0/EFC1 and flash model) instead of the device. Commands are
+ * written directly (CMD_MODE_DIRECT), since the IAP routine is in the device ROM. The MPU, SCB, page cache, reads and
+ * the asynchronous queue still use device addresses and must not be used with this instance.
+ *  efc0, efc1 - EFC register blocks for flash bank 0 / flash bank 1
+ *  flash      - Flash image (2 * IFLASH_NB_OF_PAGES pages); flash address addr maps to flash + (addr - IFLASH_ADDR)
+ */
+FlashTools::FlashTools(EfcInstance *efc0, EfcInstance *efc1, void *flash) {
+    init(efc0, efc1, reinterpret_cast<uint8_t *>(flash));
+    mpu      = NULL;
+    scb      = NULL;
+    cmd_mode = CMD_MODE_DIRECT;
+}
+
+/*
+ * init: Initialize the members common to both constructors
+ *  efc0, efc1 - EFC register blocks for flash bank 0 / flash bank 1
+ *  flash      - Flash image; the flash itself (IFLASH_ADDR) on the device
+ */
+void FlashTools::init(EfcInstance *efc0, EfcInstance *efc1, uint8_t *flash) {
     
-    /* Save flash wait state/access mode values */
-    FWS0 = ((EFC0->EEFC_FMR & EEFC_FMR_FWS_Msk) >> EEFC_FMR_FWS_Pos);
-    FWS1 = ((EFC1->EEFC_FMR & EEFC_FMR_FWS_Msk) >> EEFC_FMR_FWS_Pos);
-    FAM0 = (EFC0->EEFC_FMR & EEFC_FMR_FAM);
-    FAM1 = (EFC1->EEFC_FMR & EEFC_FMR_FAM);
+    efc_bank[0] = efc0;
+    efc_bank[1] = efc1;
+    flash_image = flash;
+    efc         = efc0;
     
-    /* Initialize EFC controllers; set flash access mode and wait state values in Flash Mode Register */
-    EFC0->EEFC_FMR = FLASH_ACCESS_MODE_128 | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
-    EFC1->EEFC_FMR = FLASH_ACCESS_MODE_128 | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+    /* Commands go through the IAP routine until direct mode is selected */
+    cmd_mode    = CMD_MODE_IAP;
+    cmd_timeout = FLASH_CMD_TIMEOUT;
     
     /* Initialize unique Id array member */
     for (size_t i {0}; i < UNIQUE_ID_SIZE; ++i) {
         uniqueID[i] = 0;
     }
     
-    /* Initialize flash descriptor array member */
-    for (size_t i {0}; i < FLASH_DESCRIPTOR_SIZE; ++i) {
-        flash_descriptor[i] = 0;
-    }
-    flash_descriptor[FLASH_DESCRIPTOR_SIZE] = 0xFFFFFFFF;
+    /* Flash descriptors are read from the EFCs on first use */
+    descriptor_valid = 0;
+    
+    /* Erase flag is honored as given until auto erase is enabled */
+    auto_erase = false;
+    
+    /* No session open */
+    session_depth = 0;
+    
+    /* Lock bits are read on first use */
+    lock_bits[0] = lock_bits[1] = 0;
+    lock_valid   = 0;
+    
+    /* Page cache is disabled until lines are supplied */
+    cache_lines   = NULL;
+    cache_count   = 0;
+    cache_max_age = 0;
+    
+    /* Initialize write statistics */
+    clearWriteStats();
 }
 
 /*
- * Destructor: Restore flash access mode and flash wait state values.
+ * Destructor: Nothing to restore; Flash Mode Registers are only changed for the duration of a command.
  */
-__attribute__ ((noinline, section(".ramfunc"))) FlashTools::~FlashTools(void) {
-    EFC0->EEFC_FMR = FAM0 | EEFC_FMR_FWS(FWS0);
-    EFC1->EEFC_FMR = FAM1 | EEFC_FMR_FWS(FWS1);
+FlashTools::~FlashTools(void) {
 }
 
 /*
@@ -79,6 +123,15 @@ __attribute__ ((noinline, section(".ramfunc"))) void FlashTools::setfam(uint32_t
     efc->EEFC_FMR = (efc->EEFC_FMR & (~EEFC_FMR_FAM)) | fa_mode;
 }
 
+/*
+ * setfmr: Update bits of the current EFC instance's Flash Mode Register
+ *  mask  - Bits to be changed
+ *  value - New value of those bits
+ */
+__attribute__ ((noinline, section(".ramfunc"))) void FlashTools::setfmr(uint32_t mask, uint32_t value) {
+    efc->EEFC_FMR = (efc->EEFC_FMR & ~mask) | (value & mask);
+}
+
 /*
  * getfws: Read wait state value from the current EFC instance's Flash Mode Register
  * Returns wait state value.
@@ -96,13 +149,58 @@ uint32_t FlashTools::getfam(void) {
 }
 
 /*
- * cmd: Write command to EEFC using IAP routine located in ROM. Commands must be written with write protection key (0x5A).
+ * minWaitStates: Get the minimum number of flash wait states that is safe for a core clock frequency
+ *  clock_hz - Core clock frequency in Hz (e.g. SystemCoreClock)
+ * Returns the wait state value for the Flash Mode Register FWS field
+ */
+uint32_t FlashTools::minWaitStates(uint32_t clock_hz) {
+    return clock_hz <= FLASH_FREQ_FWS_0 ? 0 : clock_hz <= FLASH_FREQ_FWS_1 ? 1 : clock_hz <= FLASH_FREQ_FWS_2 ? 2
+         : clock_hz <= FLASH_FREQ_FWS_3 ? 3 : 4;
+}
+
+/*
+ * tuneFlash: Set both EFCs to the minimum safe wait states for the current SystemCoreClock and apply a read profile.
+ * Call again after changing the core clock. Use Example 8 to measure which profile suits an application phase.
+ *  profile - FLASH_PROFILE_CODE: 128-bit access with sequential code optimization, for code-fetch-heavy phases
+ *            FLASH_PROFILE_DATA: 64-bit access with sequential code optimization disabled, so instruction
+ *            prefetch does not compete with data reads in data-read-heavy phases
+ * Returns 0 on success or invalid code on failure
+ */
+uint32_t FlashTools::tuneFlash(uint32_t profile) {
+    
+    if (profile != FLASH_PROFILE_CODE && profile != FLASH_PROFILE_DATA) {
+        return INVALID;
+    }
+    
+    const uint32_t FMR_MASK  {EEFC_FMR_FWS_Msk | EEFC_FMR_FAM | EEFC_FMR_SCOD};
+    const uint32_t FMR_VALUE {EEFC_FMR_FWS(minWaitStates(SystemCoreClock))
+                              | (profile == FLASH_PROFILE_DATA ? FLASH_ACCESS_MODE_64 | EEFC_FMR_SCOD : FLASH_ACCESS_MODE_128)};
+    
+    EfcInstance *saved_efc {efc};
+    efc = EFC0;
+    setfmr(FMR_MASK, FMR_VALUE);
+    efc = EFC1;
+    setfmr(FMR_MASK, FMR_VALUE);
+    efc = saved_efc;
+    
+    return SUCCESS;
+}
+
+/*
+ * cmd: Write command to EEFC using the IAP routine located in ROM, or directly to EEFC_FCR in direct command mode.
+ * Commands must be written with write protection key (0x5A).
  *  cmd - Command (FCMD)
  *  arg - Flash command argument (FARG)
- * Returns 0 if successful or error flags in Flash Status Register
+ * Returns 0 if successful, error flags in Flash Status Register, or TIMEOUT (direct mode only)
  */
 uint32_t FlashTools::cmd(uint32_t cmd, uint32_t arg) {
     
+    /* EFC1 belongs to the asynchronous queue until it is empty: a command would clear the error flags of the page
+       in progress */
+    if (efc == EFC1 && asyncBusy()) {
+        return ERROR;
+    }
+    
     /* EFC Flash Command Register definition */
     EEFC_FCR_Type EFC_FCR_REGISTER;
     
@@ -111,68 +209,351 @@ uint32_t FlashTools::cmd(uint32_t cmd, uint32_t arg) {
     EFC_FCR_REGISTER.SECTION.FKEY = FWP_KEY; // Set bits 8-23 with flash argument
     EFC_FCR_REGISTER.SECTION.FARG = arg;     // Set bits 23-31 with flash write protection key
     
-    /* Send the corresponding EFC index and command */
-    IAP((efc == EFC0 ? 0 : 1), EFC_FCR_REGISTER.FULL);
+    /* Set wait state for the duration of the command - 6 wait states for flash operations - datasheet pg. 303.
+       Inside a FlashSession the wait states are already set                                                */
+    uint32_t fws {getfws()};
+    if (session_depth == 0) {
+        setfws(CHIP_FLASH_WAIT_STATE);
+    }
+    
+    /* Direct mode: write the command register from RAM and poll the status register.
+       IAP mode: send the corresponding EFC index and command, then read the Flash Status Register */
+    uint32_t status;
+    if (cmd_mode == CMD_MODE_DIRECT) {
+        status = cmddirect(EFC_FCR_REGISTER.FULL);
+    } else {
+        IAP((efc == EFC0 ? 0 : 1), EFC_FCR_REGISTER.FULL);
+        status = efc->EEFC_FSR & EEFC_ERROR_FLAGS;
+    }
+    
+    /* Restore wait state value */
+    if (session_depth == 0) {
+        setfws(fws);
+    }
+    
+    /* Return 0 if successful or error flags */
+    return status;
+}
+
+/*
+ * cmddirect: Write a command to the current EFC instance's Flash Command Register and poll the Flash Status
+ * Register until FRDY rises or the command timeout expires. Runs from RAM since the flash bank may be busy.
+ *  fcr - Full Flash Command Register value (FKEY | FARG | FCMD)
+ * Returns 0 if successful, error flags in Flash Status Register, or TIMEOUT
+ */
+__attribute__ ((noinline, section(".ramfunc"))) uint32_t FlashTools::cmddirect(uint32_t fcr) {
+    
+    uint32_t stat, polls;
+    
+    /* Wait for any previous command to finish */
+    for (polls = cmd_timeout, stat = efc->EEFC_FSR; !(stat & EEFC_FSR_FRDY) && polls; --polls, stat = efc->EEFC_FSR);
+    if (!(stat & EEFC_FSR_FRDY)) {
+        return TIMEOUT;
+    }
+    
+    /* Write command, then wait for FRDY bit to rise. Error flags are cleared on read, so keep the last status */
+    efc->EEFC_FCR = fcr;
+    for (polls = cmd_timeout, stat = efc->EEFC_FSR; !(stat & EEFC_FSR_FRDY) && polls; --polls, stat = efc->EEFC_FSR);
     
-    /* Return Flash Status Register value -- 0 if successful or error flags */
-    return (efc->EEFC_FSR & EEFC_ERROR_FLAGS);
+    return (stat & EEFC_FSR_FRDY) ? (stat & EEFC_ERROR_FLAGS) : TIMEOUT;
 }
 
 /*
- * flashcpy: Copies from
- *  page_address - Address of page to be written
+ * pageimage: Get the image of a flash page; the page itself (whose writes go to the page latch) on the device
+ *  page_address - Flash address of the page
+ * Returns a pointer to the first word of the page image
+ */
+uint32_t *FlashTools::pageimage(uint32_t page_address) {
+    return reinterpret_cast<uint32_t *>(flash_image + (page_address - IFLASH_ADDR));
+}
+
+/*
+ * flashcpy: Fills the page latch straight from write_data and the current flash page. Words fully covered by
+ * write_data are compared and stored with the burst word kernels; partially covered words are merged with the
+ * flash word in registers. Every word is compared with flash as it is written, so no staging buffer is needed.
+ *  page         - Image of the page to be written (the page latch on the device)
  *  write_data   - Data buffer containing new data to be written to page
  *  offset       - Amount data is offset from the beginning of page
  *  write_size   - Size of data in write_data
  *  padding_size - Size of padding (remaining space on page after copying offset and write_data)
- *  Returns pointer to flash page
+ *  Returns PAGE_UNCHANGED if the page already holds the new data, PAGE_PROGRAM if the new data only clears bits,
+ *  otherwise PAGE_ERASE
  */
-uint32_t *FlashTools::flashcpy(uint32_t page_address, const void *write_data,
-                               uint32_t offset, uint32_t write_size, uint32_t padding_size) {
-
-    // Static page buffer -- All data is copied to page_buffer byte
-    // by byte first, then written to flash in 32-bit words
-    static uint32_t page_buffer[IFLASH_WORDS_PER_PAGE] {0};
-
-    // Data is copied from flash page and data buffer to page_buffer in 3 parts: offset, data, padding
-    uint32_t sizes[3] {offset, write_size, padding_size};
+uint32_t FlashTools::flashcpy(uint32_t *page, const void *write_data,
+                              uint32_t offset, uint32_t write_size, uint32_t padding_size) {
     
-    // Copy destination is page buffer
-    uint8_t *dest = reinterpret_cast<uint8_t*>(page_buffer);
+    // Validate page data and copy data pointers. Offset, data and padding must make up exactly one page
+    if (page == NULL || write_data == NULL || offset + write_size + padding_size != IFLASH_PAGE_SIZE) {
+        return PAGE_UNCHANGED;
+    }
     
-    // Page data located at page address
-    uint8_t *page_data = reinterpret_cast<uint8_t*>(page_address);
+    uint32_t *flash {page};
+    const uint8_t *src {reinterpret_cast<const uint8_t *>(write_data)};
+    const uint32_t data_end {offset + write_size};
+    uint32_t changed {0}, set_bits {0};
     
-    // Validate page data and copy data pointers
-    if (page_data == NULL || write_data == NULL) {
-        return NULL;
+    // Words fully inside data are compared and copied to the latch with the burst kernels
+    const uint32_t FIRST_FULL {(offset + IFLASH_WORD_SIZE - 1) / IFLASH_WORD_SIZE};
+    const uint32_t END_FULL   {data_end / IFLASH_WORD_SIZE};
+    
+    // Each remaining latch word is made of up to 3 parts: offset and padding bytes keep the current flash
+    // contents, data bytes come from write_data
+    for (uint32_t w {0}, b {0}; w < IFLASH_WORDS_PER_PAGE; ++w, b += IFLASH_WORD_SIZE) {
+        
+        if (w == FIRST_FULL && FIRST_FULL < END_FULL) {
+            uint32_t cmp {flashWordCompare(flash + w, src + (b - offset), END_FULL - w)};
+            changed  |= cmp & FLASH_CMP_DIFFERENT;
+            set_bits |= cmp & FLASH_CMP_SETS_BITS;
+            flashWordCopy(flash + w, src + (b - offset), END_FULL - w);
+            b += (END_FULL - 1 - w) * IFLASH_WORD_SIZE;
+            w  = END_FULL - 1;
+            continue;
+        }
+        
+        uint32_t old_word {flash[w]}, new_word {old_word};
+        
+        // Head or tail word: merge the covered data bytes into the flash word
+        for (uint32_t i {b < offset ? offset - b : 0}; i < IFLASH_WORD_SIZE && b + i < data_end; ++i) {
+            new_word = (new_word & ~(0xFFu << (8 * i))) | (static_cast<uint32_t>(src[b + i - offset]) << (8 * i));
+        }
+        
+        // Programming can only move bits from 1 to 0, so any new bit set where the flash bit is clear requires an erase
+        changed  |= old_word ^ new_word;
+        set_bits |= ~old_word & new_word;
+        flash[w] = new_word;
     }
     
-    // Copy data to be written to flash to page_buffer
-    // Part 1: Copy offset from flash page to page buffer
-    // Part 2: Copy write data from data buffer to page buffer
-    // Part 3: Copy padding from flash page to page buffer
-    for (size_t i {0}; i < 3; ++i) {
+    return set_bits ? PAGE_ERASE : changed ? PAGE_PROGRAM : PAGE_UNCHANGED;
+}
+
+/*
+ * flashcpyv: Fills the page latch from the current flash page and every segment overlapping the page.
+ * Where segments overlap, the one later in the iovec array wins.
+ *  page         - Image of the page (the page latch on the device)
+ *  page_address - Flash address of page to be written
+ *  iov          - Segment array
+ *  segs         - Indices of the segments overlapping the page, in ascending order
+ *  seg_count    - Number of indices in segs
+ *  Returns PAGE_UNCHANGED if the page already holds the new data, PAGE_PROGRAM if the new data only clears bits,
+ *  otherwise PAGE_ERASE
+ */
+uint32_t FlashTools::flashcpyv(uint32_t *page, uint32_t page_address, const FlashIovec *iov, const uint8_t *segs, uint32_t seg_count) {
+    
+    uint32_t *flash {page};
+    uint32_t changed {0}, set_bits {0};
+    
+    for (uint32_t w {0}, addr {page_address}; w < IFLASH_WORDS_PER_PAGE; ++w, addr += IFLASH_WORD_SIZE) {
+        
+        uint32_t old_word {flash[w]}, new_word {old_word};
         
-        // When copying offset and padding, we copy from the flash page to the page buffer
-        //  to avoid unneccessarily overwriting data in these parts of the page.
-        // When copying the new data, we copy from data buffer
-        memcpy(dest, (i==1 ? write_data : page_data), sizes[i]);
+        // Apply each overlapping segment in order: whole words with one load, partial words byte by byte
+        for (uint32_t i {0}; i < seg_count; ++i) {
+            const FlashIovec &seg {iov[segs[i]]};
+            const uint8_t *data {reinterpret_cast<const uint8_t *>(seg.data)};
+            if (seg.addr <= addr && addr + IFLASH_WORD_SIZE <= seg.addr + seg.size) {
+                memcpy(&new_word, data + (addr - seg.addr), IFLASH_WORD_SIZE);
+            } else if (seg.addr < addr + IFLASH_WORD_SIZE && addr < seg.addr + seg.size) {
+                for (uint32_t b {seg.addr > addr ? seg.addr - addr : 0}; b < IFLASH_WORD_SIZE && addr + b < seg.addr + seg.size; ++b) {
+                    new_word = (new_word & ~(0xFFu << (8 * b))) | (static_cast<uint32_t>(data[addr + b - seg.addr]) << (8 * b));
+                }
+            }
+        }
         
-        // Increment dest address and page data address by size of previous copy
-        dest += sizes[i];
-        page_data += sizes[i];
+        changed  |= old_word ^ new_word;
+        set_bits |= ~old_word & new_word;
+        flash[w] = new_word;
+    }
+    
+    return set_bits ? PAGE_ERASE : changed ? PAGE_PROGRAM : PAGE_UNCHANGED;
+}
+
+/*
+ * pagecmd: Sends the write command for a page staged in the current EFC's latch. Unchanged pages are not
+ * programmed (only the lock bit is set if requested). In auto erase mode, pages that only clear bits are
+ * written without erase.
+ *  page_num    - Page number within the current EFC's flash bank
+ *  page_status - PageStatus returned by flashcpy / flashcpyv
+ *  erase       - Erase page before writing
+ *  lock        - Lock page after writing
+ * Returns 0 if successful, Flash Status Register error flag or TIMEOUT
+ */
+uint32_t FlashTools::pagecmd(uint32_t page_num, uint32_t page_status, bool erase, bool lock) {
+    
+    if (page_status == PAGE_UNCHANGED) {
+        ++write_stats.pages_skipped;
+        uint32_t status {lock ? cmd(EFC_FCMD_SLB, page_num) : SUCCESS};
+        if (lock && status == SUCCESS) {
+            lock_bits[efc == efc_bank[1]] |= 1u << (page_num / IFLASH_LOCK_REGION_PAGES);
+        }
+        return status;
+    }
+    
+    // In auto erase mode, skip the erase cycle when the update only clears bits
+    bool erase_page {erase && !(auto_erase && page_status == PAGE_PROGRAM)};
+    
+    uint32_t status {cmd((erase_page && lock) ? EFC_FCMD_EWPL : (erase_page) ? EFC_FCMD_EWP : (lock) ? EFC_FCMD_WPL : EFC_FCMD_WP, page_num)};
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    ++write_stats.pages_programmed;
+    if (erase && !erase_page) {
+        ++write_stats.erases_skipped;
+    }
+    if (lock) {
+        lock_bits[efc == efc_bank[1]] |= 1u << (page_num / IFLASH_LOCK_REGION_PAGES);
+    }
+    return SUCCESS;
+}
+
+/*
+ * flashWordCopy: Copies words to a word aligned destination (RAM or the flash page latch), 8 words per LDM/STM pair.
+ * A misaligned source is read as aligned words and shifted into place.
+ *  dst   - Word aligned destination
+ *  src   - Source, any alignment
+ *  words - Number of 32-bit words to copy
+ */
+void flashWordCopy(uint32_t *dst, const void *src, uint32_t words) {
+    
+    /* Misaligned source: combine each pair of aligned source words (little endian). The upper bytes of the last word
+       are loaded byte by byte, so the copy never reads past the end of the source */
+    const uint32_t SHIFT {8 * (reinterpret_cast<uintptr_t>(src) & 3)};
+    if (SHIFT) {
+        if (words == 0) {
+            return;
+        }
+        const uint32_t *s {reinterpret_cast<const uint32_t *>(reinterpret_cast<uintptr_t>(src) & ~static_cast<uintptr_t>(3))};
+        uint32_t lo {*s++}, hi;
+        for (; words > 1; --words, lo = hi) {
+            hi = *s++;
+            *dst++ = (lo >> SHIFT) | (hi << (32 - SHIFT));
+        }
+        const uint8_t *tail {reinterpret_cast<const uint8_t *>(s)};
+        hi = 0;
+        for (uint32_t i {0}; i < SHIFT / 8; ++i) {
+            hi |= static_cast<uint32_t>(tail[i]) << (8 * i);
+        }
+        *dst = (lo >> SHIFT) | (hi << (32 - SHIFT));
+        return;
+    }
+    
+    const uint32_t *s {reinterpret_cast<const uint32_t *>(src)};
+#if defined(__ARM_ARCH_7M__) && !defined(FLASHTOOLS_REFERENCE_KERNELS)
+    /* 8 words per iteration. r7 (frame pointer) and r11 are left to the compiler */
+    __asm__ volatile (
+        "   cmp   %[n], #8                                   \n"
+        "   blo   2f                                         \n"
+        "1: ldmia %[s]!, {r3, r4, r5, r6, r8, r9, r10, r12}  \n"
+        "   stmia %[d]!, {r3, r4, r5, r6, r8, r9, r10, r12}  \n"
+        "   subs  %[n], %[n], #8                             \n"
+        "   cmp   %[n], #8                                   \n"
+        "   bhs   1b                                         \n"
+        "2:                                                  \n"
+        : [d] "+r" (dst), [s] "+r" (s), [n] "+r" (words)
+        :
+        : "r3", "r4", "r5", "r6", "r8", "r9", "r10", "r12", "cc", "memory");
+#endif
+    
+    /* Reference loop / remaining words */
+    while (words-- > 0) {
+        *dst++ = *s++;
+    }
+}
+
+/*
+ * flashWordCompare: Compares new words against old words (e.g. flash contents), 4 + 4 words per LDM pair
+ *  old_words - Word aligned current contents
+ *  new_words - New contents, any alignment
+ *  words     - Number of 32-bit words to compare
+ * Returns 0 if identical, otherwise FLASH_CMP_DIFFERENT, plus FLASH_CMP_SETS_BITS if any bit goes from 0 to 1
+ */
+uint32_t flashWordCompare(const uint32_t *old_words, const void *new_words, uint32_t words) {
+    
+    uint32_t diff {0}, set_bits {0};
+    const uint8_t *n {reinterpret_cast<const uint8_t *>(new_words)};
+    
+#if defined(__ARM_ARCH_7M__) && !defined(FLASHTOOLS_REFERENCE_KERNELS)
+    /* Aligned source: 4 words from each buffer per iteration. (old ^ new) & new is new & ~old */
+    if (!(reinterpret_cast<uintptr_t>(n) & 3)) {
+        __asm__ volatile (
+            "   cmp   %[w], #4                                \n"
+            "   blo   2f                                      \n"
+            "1: ldmia %[o]!, {r3, r4, r5, r6}                 \n"
+            "   ldmia %[n]!, {r8, r9, r10, r12}               \n"
+            "   eor   r3, r3, r8                              \n"
+            "   eor   r4, r4, r9                              \n"
+            "   eor   r5, r5, r10                             \n"
+            "   eor   r6, r6, r12                             \n"
+            "   and   r8, r8, r3                              \n"
+            "   and   r9, r9, r4                              \n"
+            "   and   r10, r10, r5                            \n"
+            "   and   r12, r12, r6                            \n"
+            "   orr   r3, r3, r4                              \n"
+            "   orr   r5, r5, r6                              \n"
+            "   orr   r8, r8, r9                              \n"
+            "   orr   r10, r10, r12                           \n"
+            "   orr   %[diff], %[diff], r3                    \n"
+            "   orr   %[diff], %[diff], r5                    \n"
+            "   orr   %[set], %[set], r8                      \n"
+            "   orr   %[set], %[set], r10                     \n"
+            "   subs  %[w], %[w], #4                          \n"
+            "   cmp   %[w], #4                                \n"
+            "   bhs   1b                                      \n"
+            "2:                                               \n"
+            : [o] "+r" (old_words), [n] "+r" (n), [w] "+r" (words), [diff] "+r" (diff), [set] "+r" (set_bits)
+            :
+            : "r3", "r4", "r5", "r6", "r8", "r9", "r10", "r12", "cc", "memory");
+    }
+#endif
+    
+    /* Reference loop / remaining words. memcpy handles a misaligned source */
+    for (uint32_t new_word; words > 0; --words, n += IFLASH_WORD_SIZE) {
+        memcpy(&new_word, n, IFLASH_WORD_SIZE);
+        diff     |= *old_words ^ new_word;
+        set_bits |= ~*old_words++ & new_word;
     }
     
-    // Copy data from page_buffer to flash page in 32-bit words
-    uint32_t *flash {reinterpret_cast<uint32_t *>(page_address)};
-    uint32_t *src {page_buffer};
-    for (size_t t {0}; t < IFLASH_WORDS_PER_PAGE; ++t) {
-        *flash++ = *src++;
+    return (diff ? FLASH_CMP_DIFFERENT : 0) | (set_bits ? FLASH_CMP_SETS_BITS : 0);
+}
+
+/*
+ * flashBlankCheck: Checks whether words are erased (all bits set), 8 words per LDM
+ *  addr  - Word aligned address
+ *  words - Number of 32-bit words to check
+ * Returns true if every word is 0xFFFFFFFF
+ */
+bool flashBlankCheck(const uint32_t *addr, uint32_t words) {
+    
+    uint32_t acc {0xFFFFFFFF};
+    
+#if defined(__ARM_ARCH_7M__) && !defined(FLASHTOOLS_REFERENCE_KERNELS)
+    __asm__ volatile (
+        "   cmp   %[w], #8                                   \n"
+        "   blo   2f                                         \n"
+        "1: ldmia %[a]!, {r3, r4, r5, r6, r8, r9, r10, r12}  \n"
+        "   and   r3, r3, r4                                 \n"
+        "   and   r5, r5, r6                                 \n"
+        "   and   r8, r8, r9                                 \n"
+        "   and   r10, r10, r12                              \n"
+        "   and   r3, r3, r5                                 \n"
+        "   and   r8, r8, r10                                \n"
+        "   and   %[acc], %[acc], r3                         \n"
+        "   and   %[acc], %[acc], r8                         \n"
+        "   subs  %[w], %[w], #8                             \n"
+        "   cmp   %[w], #8                                   \n"
+        "   bhs   1b                                         \n"
+        "2:                                                  \n"
+        : [a] "+r" (addr), [w] "+r" (words), [acc] "+r" (acc)
+        :
+        : "r3", "r4", "r5", "r6", "r8", "r9", "r10", "r12", "cc", "memory");
+#endif
+    
+    /* Reference loop / remaining words */
+    while (words-- > 0) {
+        acc &= *addr++;
     }
     
-    // Return flash page start address
-    return reinterpret_cast<uint32_t *>(page_address);
+    return acc == 0xFFFFFFFF;
 }
 
 /*
@@ -184,7 +565,7 @@ uint32_t FlashTools::setEFC(uint32_t efc_idx) {
     if (efc_idx != 0 && efc_idx != 1) {
         return INVALID;
     } else {
-        efc = !efc_idx ? EFC0 : EFC1;
+        efc = efc_bank[efc_idx];
         return SUCCESS;
     }
 }
@@ -194,9 +575,46 @@ uint32_t FlashTools::setEFC(uint32_t efc_idx) {
  * Returns EFC_IDX_0 (0) for EFC0 or EDC_IDX_1 (1) for EFC1
  */
 uint32_t FlashTools::getEFC(void) {
-    return efc == EFC0 ? 0 : 1;
+    return efc == efc_bank[0] ? 0 : 1;
+}
+
+
+/*
+ * setCommandMode: Select how EFC commands are issued
+ *  mode - CMD_MODE_IAP (ROM IAP routine, blocks until FRDY) or CMD_MODE_DIRECT (EEFC_FCR written from RAM,
+ *         EEFC_FSR polled with a timeout)
+ * Returns 0 on success or invalid code on failure
+ */
+uint32_t FlashTools::setCommandMode(uint32_t mode) {
+    if (mode != CMD_MODE_IAP && mode != CMD_MODE_DIRECT) {
+        return INVALID;
+    }
+    cmd_mode = mode;
+    return SUCCESS;
+}
+
+/*
+ * getCommandMode: Get current command mode
+ * Returns CMD_MODE_IAP or CMD_MODE_DIRECT
+ */
+uint32_t FlashTools::getCommandMode(void) {
+    return cmd_mode;
 }
 
+/*
+ * setCommandTimeout: Set the number of Flash Status Register polls before a direct mode command times out
+ *  polls - Number of polls (default FLASH_CMD_TIMEOUT)
+ */
+void FlashTools::setCommandTimeout(uint32_t polls) {
+    cmd_timeout = polls;
+}
+
+/*
+ * getCommandTimeout: Get the direct mode command timeout in Flash Status Register polls
+ */
+uint32_t FlashTools::getCommandTimeout(void) {
+    return cmd_timeout;
+}
 
 /*
  * getUniqueID: Get the MCU's 4-part, 128-bit unique ID
@@ -214,6 +632,11 @@ __attribute__ ((noinline, section(".ramfunc"))) uint32_t FlashTools::getUniqueID
         return SUCCESS;
     }
     
+    /* EFC1 cannot be used while asynchronous writes are queued */
+    if (efc == EFC1 && async_head != async_tail) {
+        return ERROR;
+    }
+    
     /* Get wait state value, then set wait states to 6 */
     uint32_t fws {getfws()};
     setfws(CHIP_FLASH_WAIT_STATE);
@@ -221,7 +644,8 @@ __attribute__ ((noinline, section(".ramfunc"))) uint32_t FlashTools::getUniqueID
     /*  Get address for read operation */
     uint32_t *tmpUniqueID {reinterpret_cast<uint32_t*>((efc == EFC0) ? IFLASH0_ADDR : IFLASH1_ADDR)};
     
-    /* Disable code loops optimization */
+    /* Disable code loops optimization (previous setting is restored afterwards) */
+    uint32_t scod {efc->EEFC_FMR & EEFC_FMR_SCOD};
     efc->EEFC_FMR |= EEFC_FMR_SCOD;
     
     /* Start read command - write directly to EEFC flash command register */
@@ -250,8 +674,8 @@ __attribute__ ((noinline, section(".ramfunc"))) uint32_t FlashTools::getUniqueID
     /* Wait for FRDY bit to rise */
     for (volatile uint32_t stat = efc->EEFC_FSR; (stat & EEFC_FSR_FRDY) != EEFC_FSR_FRDY; stat = efc->EEFC_FSR);
     
-    /* Enable code loops optimization */
-    efc->EEFC_FMR &= ~EEFC_FMR_SCOD;
+    /* Restore code loops optimization */
+    efc->EEFC_FMR = (efc->EEFC_FMR & ~EEFC_FMR_SCOD) | scod;
     
     /* Restore wait state value. Return error code on read failure */
     setfws(fws);
@@ -259,20 +683,73 @@ __attribute__ ((noinline, section(".ramfunc"))) uint32_t FlashTools::getUniqueID
     return SUCCESS;
 }
 
+/*
+ * gpnvmcmd: Sends a GPNVM command to EFC0, which holds the GPNVM bits whichever EFC is selected
+ *  command - EFC_FCMD_SGPB, EFC_FCMD_CGPB or EFC_FCMD_GGPB
+ *  bit     - GPNVM bit number (0 for GGPB)
+ * Returns 0 if successful, Flash Status Register error flags or TIMEOUT
+ */
+uint32_t FlashTools::gpnvmcmd(uint32_t command, uint32_t bit) {
+    EfcInstance *saved_efc {efc};
+    efc = EFC0;
+    uint32_t status {cmd(command, bit)};
+    efc = saved_efc;
+    return status;
+}
+
+/*
+ * getGPNVM: Gets all GPNVM bits with a single GGPB command
+ * Returns GPNVM bit mask (GPNVM_SECURITY | GPNVM_BOOT_FLASH | GPNVM_BOOT_FLASH1) or error code on cmd fail
+ */
+uint32_t FlashTools::getGPNVM(void) {
+    
+    if (gpnvmcmd(EFC_FCMD_GGPB, 0) != SUCCESS) {
+        return ERROR;
+    }
+    
+    return EFC0->EEFC_FRR & GPNVM_MASK;
+}
+
+/*
+ * applyBootConfig: Moves the GPNVM bits to a desired state with one GGPB and only the SGPB/CGPB commands needed.
+ * The security bit is set last, after the boot bits, since it blocks further access from a debugger.
+ *  desired - Desired GPNVM bit mask (GPNVM_* bits)
+ *  mask    - Optional. GPNVM bits to change; default GPNVM_BOOT_FLASH | GPNVM_BOOT_FLASH1
+ * Returns 0 on success, invalid code if the security bit would have to be cleared, or error code on failure
+ */
+uint32_t FlashTools::applyBootConfig(uint32_t desired, uint32_t mask) {
+    
+    uint32_t current {getGPNVM()};
+    if (current == ERROR) {
+        return ERROR;
+    }
+    
+    /* The security bit cannot be cleared by command */
+    uint32_t change {(current ^ desired) & mask & GPNVM_MASK};
+    if (change & current & GPNVM_SECURITY) {
+        return INVALID;
+    }
+    
+    /* Bits 2, 1, then 0: the boot bank (bit 2) is selected before boot from flash (bit 1) is enabled, so a reset
+       between the two commands boots from ROM (SAM-BA) rather than from the other bank; the security bit goes last */
+    uint32_t status {SUCCESS};
+    for (uint32_t i {0}; i < 3 && status == SUCCESS; ++i) {
+        const uint32_t bit {2 - i};
+        if (change & (1u << bit)) {
+            status = gpnvmcmd((desired & (1u << bit)) ? EFC_FCMD_SGPB : EFC_FCMD_CGPB, bit);
+        }
+    }
+    
+    return status;
+}
+
 /*
  * setSecurityBit: Set security bit (GPNVM bit 0). Note that enabling security bit will prohibit read/writes.
  * Security bit can be cleared by manually asserting the erase pin.
  * Returns 0 on success or error code on failure.
  */
 uint32_t FlashTools::setSecurityBit(void) {
-    
-    /* Get security bit (GPNVM bit 0) and see if set. Return 0 if set. */
-    if ((cmd(EFC_FCMD_GGPB, 0) == SUCCESS) && (efc->EEFC_FRR & (1 << 0))) {
-        return SUCCESS;
-    }
-    
-    /* Send the set bit command. Return 0 if successful, otherwise return error code. */
-    return cmd(EFC_FCMD_SGPB, 0);
+    return applyBootConfig(GPNVM_SECURITY, GPNVM_SECURITY);
 }
 
 /*
@@ -280,12 +757,7 @@ uint32_t FlashTools::setSecurityBit(void) {
  * Returns 0 on success or error code on failure
  */
 uint32_t FlashTools::setBootModeSAMBA(void) {
-    
-    if ((cmd(EFC_FCMD_GGPB, 0) == SUCCESS) && !(efc->EEFC_FRR & (1 << 1))) {
-        return SUCCESS;
-    }
-    
-    return cmd(EFC_FCMD_CGPB, 1);
+    return applyBootConfig(0, GPNVM_BOOT_FLASH);
 }
 
 /*
@@ -293,12 +765,7 @@ uint32_t FlashTools::setBootModeSAMBA(void) {
  * Returns 0 on success or error code on failure.
  */
 uint32_t FlashTools::setBootModeFlash(void) {
-    
-    if ((cmd(EFC_FCMD_GGPB, 0) == SUCCESS) && (efc->EEFC_FRR & (1 << 1))) {
-        return SUCCESS;
-    }
-    
-    return cmd(EFC_FCMD_SGPB, 1);
+    return applyBootConfig(GPNVM_BOOT_FLASH, GPNVM_BOOT_FLASH);
 }
 
 /*
@@ -306,12 +773,7 @@ uint32_t FlashTools::setBootModeFlash(void) {
  * Returns 0 on success or error code on failure.
  */
 uint32_t FlashTools::setBootFlash0(void) {
-    
-    if ((cmd(EFC_FCMD_GGPB, 0) == SUCCESS) && !(efc->EEFC_FRR & (1 << 2))) {
-        return SUCCESS;
-    }
-    
-    return cmd(EFC_FCMD_CGPB, 2);
+    return applyBootConfig(0, GPNVM_BOOT_FLASH1);
 }
 
 /*
@@ -319,139 +781,197 @@ uint32_t FlashTools::setBootFlash0(void) {
  * Returns 0 on success or error code on failure.
  */
 uint32_t FlashTools::setBootFlash1(void) {
-    
-    if ((cmd(EFC_FCMD_GGPB, 0) == SUCCESS) && (efc->EEFC_FRR & (1 << 2))) {
-        return SUCCESS;
-    }
-    
-    return cmd(EFC_FCMD_SGPB, 2);
+    return applyBootConfig(GPNVM_BOOT_FLASH1, GPNVM_BOOT_FLASH1);
 }
 
 /*
- * setSecurityBit: Gets the security bit (GPNVM bit 0).
+ * getSecurityBit: Gets the security bit (GPNVM bit 0).
  * Returns 1 if the bit is set, 0 if the bit is unset, or an error code on cmd fail
  */
 uint32_t FlashTools::getSecurityBit(void) {
-    
-    if (cmd(EFC_FCMD_GGPB, 0) != SUCCESS) {
-        return ERROR;
-    }
-    
-    return (efc->EEFC_FRR & (1 << 0)) ? BIT_IS_SET : BIT_IS_CLEARED;
+    uint32_t bits {getGPNVM()};
+    return bits == ERROR ? ERROR : (bits & GPNVM_SECURITY) ? BIT_IS_SET : BIT_IS_CLEARED;
 }
 
 /*
- * getBootSelectBit: Gets the security bit (GPNVM bit 1).
+ * getBootSelectBit: Gets the boot mode select bit (GPNVM bit 1).
  * Returns 1 if the bit is set, 0 if the bit is unset, or an error code on cmd fail
  */
 uint32_t FlashTools::getBootSelectBit(void) {
-    
-    if (cmd(EFC_FCMD_GGPB, 0) != SUCCESS) {
-        return ERROR;
-    }
-    
-    return (efc->EEFC_FRR & (1 << 1)) ? BIT_IS_SET : BIT_IS_CLEARED;
+    uint32_t bits {getGPNVM()};
+    return bits == ERROR ? ERROR : (bits & GPNVM_BOOT_FLASH) ? BIT_IS_SET : BIT_IS_CLEARED;
 }
 
 /*
- * getFlashSelectBit: Gets the security bit (GPNVM bit 2).
+ * getFlashSelectBit: Gets the flash select bit (GPNVM bit 2).
  * Returns 1 if the bit is set, 0 if the bit is unset, or an error code on cmd fail
  */
 uint32_t FlashTools::getFlashSelectBit(void) {
-    
-    if (cmd(EFC_FCMD_GGPB, 0) != SUCCESS) {
-        return ERROR;
-    }
-    
-    return (efc->EEFC_FRR & (1 << 2)) ? BIT_IS_SET : BIT_IS_CLEARED;
+    uint32_t bits {getGPNVM()};
+    return bits == ERROR ? ERROR : (bits & GPNVM_BOOT_FLASH1) ? BIT_IS_SET : BIT_IS_CLEARED;
 }
 
-
 /*
- * getFlashDescriptor - Gets the 128-bit flash descriptor for the specified address
- * Returns flash descriptor array on success or null on failure
+ * refreshFlashDescriptor: Reads the flash descriptor of the bank holding addr from its EFC (GETD command) into the
+ * descriptor cache. The getters below call it once per bank; afterwards they cause no EFC traffic.
+ *  addr - Flash address within the bank
+ * Returns 0 if successful, invalid code on bad address or malformed descriptor, Flash Status Register error flags
+ * or TIMEOUT
  */
-uint32_t *FlashTools::getFlashDescriptor(uint32_t addr) {
+uint32_t FlashTools::refreshFlashDescriptor(uint32_t addr) {
     
-    /* Determine EFC based on flash address */
-    if (addr > IFLASH_LAST_PAGE_ADDRESS) {
-        return NULL;
-    } else {
-        efc = (addr >= IFLASH1_ADDR) ? EFC1 : EFC0;
+    if (addr < IFLASH_ADDR || addr > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - 1) {
+        return INVALID;
     }
     
+    const uint32_t BANK {addr >= IFLASH1_ADDR ? 1u : 0u};
+    FlashDescriptor &desc {descriptors[BANK]};
+    descriptor_valid &= ~(1u << BANK);
+    
     /* Send the get flash descriptor command. Return error on cmd failure */
-    if (cmd(EFC_FCMD_GETD, 0) != SUCCESS) {
-        return NULL;
+    EfcInstance *saved_efc {efc};
+    efc = BANK ? EFC1 : EFC0;
+    uint32_t status {cmd(EFC_FCMD_GETD, 0)};
+    
+    /* Read the result words until the EFC returns 0 */
+    desc.length = 0;
+    for (uint32_t res; status == SUCCESS && desc.length < FLASH_DESCRIPTOR_SIZE && (res = efc->EEFC_FRR) != 0; ) {
+        desc.words[desc.length++] = res;
     }
+    efc = saved_efc;
     
-    /* Read the data and save it to buf. Return SUCCESS once all results have been read */
-    for (uint32_t i {0}, res; i < FLASH_DESCRIPTOR_SIZE && (res=efc->EEFC_FRR) != 0; ++i) {
-        flash_descriptor[i] = res;
+    if (status != SUCCESS) {
+        return status;
     }
     
-    flash_descriptor[FLASH_DESCRIPTOR_SIZE] = addr;
+    /* The lock region table follows the plane table */
+    desc.lock_index = desc.length > 3 ? 4 + desc.words[3] : desc.length;
+    if (desc.lock_index >= desc.length || desc.words[desc.lock_index] > desc.length - desc.lock_index - 1) {
+        return INVALID;
+    }
     
-    return flash_descriptor;
+    descriptor_valid |= 1u << BANK;
+    return SUCCESS;
+}
+
+/*
+ * descriptor: Gets the cached flash descriptor of the bank holding addr, reading it on first use
+ * Returns pointer to the descriptor or null on failure
+ */
+FlashDescriptor *FlashTools::descriptor(uint32_t addr) {
+    if (addr < IFLASH_ADDR || addr > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - 1) {
+        return NULL;
+    }
+    const uint32_t BANK {addr >= IFLASH1_ADDR ? 1u : 0u};
+    return ((descriptor_valid & (1u << BANK)) || refreshFlashDescriptor(addr) == SUCCESS)
+           ? &descriptors[BANK] : NULL;
+}
+
+/*
+ * getFlashDescriptor - Gets the flash descriptor (GETD result words) of the bank holding the specified address
+ * Returns flash descriptor array on success or null on failure
+ */
+uint32_t *FlashTools::getFlashDescriptor(uint32_t addr) {
+    FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? desc->words : NULL;
 }
 
 /*
  * getFlashId: Gets the flash id for the specified address
  */
 uint32_t FlashTools::getFlashId(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[0] : INVALID;
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? desc->words[0] : INVALID;
 }
 
 /*
  * getFlashSize: Gets flash bank size given a flash descriptor.
  */
 uint32_t FlashTools::getFlashSize(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[1] : INVALID;
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? desc->words[1] : INVALID;
 }
 
 /*
  * getPageSize: Gets flash page size given a flash descriptor.
  */
 uint32_t FlashTools::getPageSize(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[2] : INVALID;
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? desc->words[2] : INVALID;
 }
 
 /*
- * getRegionCount: Gets region count for flash bank given an address
+ * getRegionCount: Gets lock region count for flash bank given an address
  */
 uint32_t FlashTools::getRegionCount(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[3] : INVALID;
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? desc->words[desc->lock_index] : INVALID;
 }
 
 /*
- * getRegionSize: Gets region size given an address                                                                                                   *
+ * getRegionSize: Gets size of the lock region holding the given address
  */
 uint32_t FlashTools::getRegionSize(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[4] : INVALID;
+    const FlashDescriptor *desc {descriptor(addr)};
+    if (desc == NULL || desc->words[desc->lock_index] == 0) {
+        return INVALID;
+    }
+    
+    /* Lock regions are equally sized on this device; index the table by the first region's size */
+    const uint32_t *regions {&desc->words[desc->lock_index + 1]};
+    uint32_t region {(addr - (addr >= IFLASH1_ADDR ? IFLASH1_ADDR : IFLASH0_ADDR)) / regions[0]};
+    return region < desc->words[desc->lock_index] ? regions[region] : INVALID;
 }
 
 /*
- * getPageCount: Gets total page count for flash bank given an address                                                                                *
+ * getPageCount: Gets total page count for flash bank given an address
  */
 uint32_t FlashTools::getPageCount(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[1] / flash_descriptor[2] : INVALID;
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL && desc->words[2] != 0 ? desc->words[1] / desc->words[2] : INVALID;
 }
 
 /*
- * getPageCountPerRegion: Gets page count per region for flash bank                                                                  *
+ * getPageCountPerRegion: Gets page count per lock region for flash bank
  */
 uint32_t FlashTools::getPageCountPerRegion(uint32_t addr) {
-    return flash_descriptor[FLASH_DESCRIPTOR_SIZE] == addr || getFlashDescriptor(addr) != NULL ? flash_descriptor[4] / flash_descriptor[2] : INVALID;
+    uint32_t region_size {getRegionSize(addr)};
+    uint32_t page_size   {getPageSize(addr)};
+    return region_size != INVALID && page_size != INVALID && page_size != 0 ? region_size / page_size : INVALID;
+}
+
+/*
+ * getPlaneCount: Gets the number of planes of the flash bank holding the given address
+ */
+uint32_t FlashTools::getPlaneCount(uint32_t addr) {
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? desc->words[3] : INVALID;
+}
+
+/*
+ * getRegionTable: Gets the lock region size table (FL_LOCK) of the bank holding the given address;
+ * the number of entries is returned by getRegionCount
+ * Returns pointer to the table or null on failure
+ */
+const uint32_t *FlashTools::getRegionTable(uint32_t addr) {
+    const FlashDescriptor *desc {descriptor(addr)};
+    return desc != NULL ? &desc->words[desc->lock_index + 1] : NULL;
 }
 
 /*
  * lock: Lock all regions of flash within specified address range
  *  start_addr - Beginning flash address
  *  end_addr   - Ending flash address
- * Returns 0 if successful or Flash Status Register error flag
+ * Returns 0 if successful, Flash Status Register error flag or TIMEOUT
  */
 uint32_t FlashTools::lock(uint32_t start_addr, uint32_t end_addr) {
     
+    /* Ranges crossing from flash bank 0 into flash bank 1 are locked one bank at a time */
+    if (start_addr < IFLASH1_ADDR && end_addr >= IFLASH1_ADDR) {
+        uint32_t status {lock(start_addr, IFLASH1_ADDR - 1)};
+        return status != SUCCESS ? status : lock(IFLASH1_ADDR, end_addr);
+    }
+    
     uint32_t actual_start_addr, actual_end_addr;
     uint16_t start_page, end_page, pages_in_region;
     
@@ -462,21 +982,21 @@ uint32_t FlashTools::lock(uint32_t start_addr, uint32_t end_addr) {
     
     /* Calculate start/end page numbers in lock region */
     if (actual_start_addr >= IFLASH1_ADDR) {
-        efc        = EFC1;
+        efc        = efc_bank[1];
         start_page = (actual_start_addr - IFLASH1_ADDR) / IFLASH_PAGE_SIZE;
         end_page   = (actual_end_addr   - IFLASH1_ADDR) / IFLASH_PAGE_SIZE;
     } else {
-        efc        = EFC0;
+        efc        = efc_bank[0];
         start_page = (actual_start_addr - IFLASH0_ADDR) / IFLASH_PAGE_SIZE;
         end_page   = (actual_end_addr   - IFLASH0_ADDR) / IFLASH_PAGE_SIZE;
     }
 
     /* Lock all pages in region by setting lock bit. If command fails, return the error code */
-    while (start_page < end_page) {
-        if (cmd(EFC_FCMD_SLB, start_page) != SUCCESS) {
-            return efc->EEFC_FSR & EEFC_ERROR_FLAGS;
+    for (uint32_t status; start_page < end_page; start_page += pages_in_region) {
+        if ((status = cmd(EFC_FCMD_SLB, start_page)) != SUCCESS) {
+            return status;
         }
-        start_page += pages_in_region;
+        lock_bits[efc == efc_bank[1]] |= 1u << (start_page / pages_in_region);
     }
     
     return SUCCESS;
@@ -486,10 +1006,16 @@ uint32_t FlashTools::lock(uint32_t start_addr, uint32_t end_addr) {
  * unlock: Unlocks all regions of flash within specified address range
  *  start_addr - Start flash address
  *  end_addr   - End flash address
- * Returns 0 if successful or Flash Status Register error flag(s)
+ * Returns 0 if successful, Flash Status Register error flag(s) or TIMEOUT
  */
 uint32_t FlashTools::unlock(uint32_t start_addr, uint32_t end_addr) {
     
+    /* Ranges crossing from flash bank 0 into flash bank 1 are unlocked one bank at a time */
+    if (start_addr < IFLASH1_ADDR && end_addr >= IFLASH1_ADDR) {
+        uint32_t status {unlock(start_addr, IFLASH1_ADDR - 1)};
+        return status != SUCCESS ? status : unlock(IFLASH1_ADDR, end_addr);
+    }
+    
     uint32_t actual_start_addr, actual_end_addr;
     uint16_t start_page, end_page, pages_in_region;
     
@@ -500,118 +1026,848 @@ uint32_t FlashTools::unlock(uint32_t start_addr, uint32_t end_addr) {
     
     /* Calculate start/end page numbers in lock region */
     if (actual_start_addr >= IFLASH1_ADDR) {
-        efc        = EFC1;
+        efc        = efc_bank[1];
         start_page = (actual_start_addr - IFLASH1_ADDR) / IFLASH_PAGE_SIZE;
         end_page   = (actual_end_addr   - IFLASH1_ADDR) / IFLASH_PAGE_SIZE;
     } else {
-        efc        = EFC0;
+        efc        = efc_bank[0];
         start_page = (actual_start_addr - IFLASH0_ADDR) / IFLASH_PAGE_SIZE;
         end_page   = (actual_end_addr   - IFLASH0_ADDR) / IFLASH_PAGE_SIZE;
     }
 
     /* Clear lock bit for all pages in region. If command fails, return the error code */
-    while (start_page < end_page) {
-        if (cmd(EFC_FCMD_CLB, start_page) != SUCCESS) {
-            return efc->EEFC_FSR & EEFC_ERROR_FLAGS;
-        } else start_page += pages_in_region;
+    for (uint32_t status; start_page < end_page; start_page += pages_in_region) {
+        if ((status = cmd(EFC_FCMD_CLB, start_page)) != SUCCESS) {
+            return status;
+        }
+        lock_bits[efc == efc_bank[1]] &= ~(1u << (start_page / pages_in_region));
     }
     
     return SUCCESS;
 }
 
 /*
- * islocked: Get the number of locked flash regions within specified address range
+ * islocked: Get the number of locked flash regions within specified address range, using the cached lock bits
  *  start_addr - Start flash address
  *  end_addr   - End flash address
- * Returns the number of locked flash regions on success, error flags in Flash Status Register on failure
+ * Returns the number of locked flash regions on success (0 for an empty range, end_addr < start_addr),
+ * error flags in Flash Status Register on failure
  */
 uint32_t FlashTools::islocked(uint32_t start_addr, uint32_t end_addr) {
     
-    const uint32_t READ_SIZE {32};
-    uint16_t start_page, end_page, start_region, end_region;
-    
-    /* Calculate the start/end page numbers of lock region  */
-    if (start_addr >= IFLASH1_ADDR) {
-        efc        = EFC1;
-        start_page = (start_addr - IFLASH1_ADDR) / IFLASH_PAGE_SIZE;
-        end_page   = (end_addr   - IFLASH1_ADDR) / IFLASH_PAGE_SIZE;
-    } else {
-        efc        = EFC0;
-        start_page = (start_addr - IFLASH0_ADDR) / IFLASH_PAGE_SIZE;
-        end_page   = (end_addr   - IFLASH0_ADDR) / IFLASH_PAGE_SIZE;
-    }
-    
-    /* Calculate the start/end regions */
-    start_region = start_page / (IFLASH_LOCK_REGION_SIZE / IFLASH_PAGE_SIZE);
-    end_region   = end_page   / (IFLASH_LOCK_REGION_SIZE / IFLASH_PAGE_SIZE);
-    
-    /* Send get lock bit command to flash cmd register */
-    if (cmd(EFC_FCMD_GLB,0) != SUCCESS) {
-        return efc->EEFC_FSR & EEFC_ERROR_FLAGS;
+    if (end_addr < start_addr) {
+        return 0;
     }
     
-    /* Each read corresponds to 32 lock bits - Exclude unrequested regions  */
-    uint32_t stat;
-    uint32_t involved;
-    for (involved = 0, stat = efc->EEFC_FRR; !(involved <= start_region && start_region < (involved + READ_SIZE)); involved += READ_SIZE) {
-        stat = efc->EEFC_FRR;
+    /* Ranges crossing from flash bank 0 into flash bank 1 are checked one bank at a time */
+    if (start_addr < IFLASH1_ADDR && end_addr >= IFLASH1_ADDR) {
+        return islocked(start_addr, IFLASH1_ADDR - 1) + islocked(IFLASH1_ADDR, end_addr);
     }
     
-    /* Check status of each involved region (must be at least 1 involved region) */
-    uint32_t locked_regions {0};
-    for (uint32_t bit {start_region - involved}, idx {end_region - start_region + 1}; idx > 0; --idx) {
-        if (stat & (1 << (bit))) {
-            ++locked_regions;
-        }
-        if (++bit == READ_SIZE) {
-            stat = efc->EEFC_FRR;
-            bit  = 0;
+    /* Calculate the bank and the start/end lock regions */
+    const uint32_t BANK {start_addr >= IFLASH1_ADDR ? 1u : 0u};
+    const uint32_t FLASH_START_ADDR {BANK ? IFLASH1_ADDR : IFLASH0_ADDR};
+    uint32_t start_region {(start_addr - FLASH_START_ADDR) / IFLASH_LOCK_REGION_SIZE};
+    uint32_t end_region   {(end_addr   - FLASH_START_ADDR) / IFLASH_LOCK_REGION_SIZE};
+    
+    /* Lock bits are read from the EFC once per bank, then kept up to date by lock/unlock/write */
+    if (!(lock_valid & (1u << BANK))) {
+        uint32_t status {refreshLockState()};
+        if (status != SUCCESS) {
+            return status;
         }
     }
     
+    /* Count the set lock bits of the requested regions */
+    uint32_t mask {((2u << end_region) - 1) & ~((1u << start_region) - 1)};
+    uint32_t locked_regions {static_cast<uint32_t>(__builtin_popcount(lock_bits[BANK] & mask))};
+    
     /* Return the number of set lock bits for region */
     return locked_regions;
 }
 
+/*
+ * refreshLockState: Reads the lock bits of both flash banks from the EFCs (GLB command) into the lock bit cache.
+ * Only needed if lock bits are changed outside this object; islocked() fills the cache on first use.
+ * Returns 0 if successful, Flash Status Register error flags or TIMEOUT
+ */
+uint32_t FlashTools::refreshLockState(void) {
+    
+    EfcInstance *saved_efc {efc};
+    uint32_t status {SUCCESS};
+    
+    lock_valid = 0;
+    for (uint32_t bank {0}; bank < 2 && status == SUCCESS; ++bank) {
+        efc = efc_bank[bank];
+        if ((status = cmd(EFC_FCMD_GLB, 0)) == SUCCESS) {
+            lock_bits[bank] = efc->EEFC_FRR;
+            lock_valid |= 1u << bank;
+        }
+    }
+    
+    efc = saved_efc;
+    return status;
+}
+
 /*
  * erase: Erase the entire flash bank at the specified address
  *  addr - Flash bank address
  * Returns 0 if successful or Flash Status Register error flags
  */
 uint32_t FlashTools::erase(uint32_t addr) {
+    
+    /* Pending cached writes to the bank are discarded */
+    if (cache_lines != NULL) {
+        cacheevict(addr >= IFLASH1_ADDR ? IFLASH1_ADDR : IFLASH0_ADDR,
+                   addr >= IFLASH1_ADDR ? IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - 1 : IFLASH1_ADDR - 1, false);
+    }
+    
     efc = (addr >= IFLASH1_ADDR) ? EFC1 : EFC0;
     return cmd(EFC_FCMD_EA, 0);
 }
 
 /*
- * MPUConfigureRegion - Configure a region of memory (main memory or flash)
- *  addr - memory address
+ * setAutoErase: Enable or disable automatic erase selection. When enabled, writes requested with erase = true
+ * use the write page command (no erase) for every page whose update needs no bit to go from 0 to 1.
+ *  enable - true to enable, false to always honor the erase flag
+ */
+void FlashTools::setAutoErase(bool enable) {
+    auto_erase = enable;
+}
+
+/*
+ * getAutoErase: Get whether automatic erase selection is enabled
+ */
+bool FlashTools::getAutoErase(void) {
+    return auto_erase;
+}
+
+/*
+ * getWriteStats: Get the page write statistics collected since construction or the last clearWriteStats
+ * Returns reference to write statistics
+ */
+const FlashWriteStats &FlashTools::getWriteStats(void) {
+    return write_stats;
+}
+
+/*
+ * clearWriteStats: Reset all page write statistics to 0
+ */
+void FlashTools::clearWriteStats(void) {
+    write_stats.pages_programmed = 0;
+    write_stats.pages_skipped    = 0;
+    write_stats.erases_skipped   = 0;
+}
+
+/*
+ * enableCache: Enables the write-back page cache. write() calls with erase = true and lock = false then only update
+ * RAM cache lines, and read() returns pending data. Program-only writes (erase = false) keep their AND semantics by
+ * going to flash after the cached data for their range is written back. Pages are programmed by flush(), flushPage(), flushExpired(), when a line has to be
+ * reused, or when the cache is disabled. writev(), writeAsync() and writeInterleaved() bypass the cache; flush the
+ * affected pages before using them on cached data.
+ *  lines            - Cache line storage (each line holds one 256 byte page)
+ *  count            - Number of lines
+ *  max_dirty_age_ms - Optional. Lines dirty for at least this long are written back by write() and flushExpired();
+ *                     0 disables the timed flush
+ * Returns 0 if successful, invalid code on bad arguments, or error flags if flushing the previous cache failed
+ */
+uint32_t FlashTools::enableCache(FlashCacheLine *lines, uint32_t count, uint32_t max_dirty_age_ms) {
+    
+    if (lines == NULL || count == 0) {
+        return INVALID;
+    }
+    
+    uint32_t status {disableCache()};
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    for (uint32_t i {0}; i < count; ++i) {
+        lines[i].page_address = 0;
+    }
+    cache_lines   = lines;
+    cache_count   = count;
+    cache_max_age = max_dirty_age_ms;
+    return SUCCESS;
+}
+
+/*
+ * disableCache: Writes back all dirty lines and disables the page cache
+ * Returns 0 if successful or Flash Status Register error flags (cache stays enabled on failure)
+ */
+uint32_t FlashTools::disableCache(void) {
+    
+    uint32_t status {flush()};
+    if (status == SUCCESS) {
+        cache_lines = NULL;
+        cache_count = 0;
+    }
+    return status;
+}
+
+/*
+ * flush: Writes back all dirty cache lines
+ * Returns 0 if successful or Flash Status Register error flags of the first failed page
+ */
+uint32_t FlashTools::flush(void) {
+    return cache_lines != NULL ? cacheevict(IFLASH_ADDR, IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - 1, true) : SUCCESS;
+}
+
+/*
+ * flushPage: Writes back the cache line holding addr, if any
+ *  addr - Any flash address within the page
+ * Returns 0 if successful or Flash Status Register error flags
+ */
+uint32_t FlashTools::flushPage(uint32_t addr) {
+    return cache_lines != NULL ? cacheevict(addr, addr, true) : SUCCESS;
+}
+
+/*
+ * flushExpired: Writes back cache lines that have been dirty for at least the maximum dirty age.
+ * Call periodically (e.g. from loop()) to bound how long data stays only in RAM.
+ * Returns 0 if successful or Flash Status Register error flags of the first failed page
+ */
+uint32_t FlashTools::flushExpired(void) {
+    
+    if (cache_lines == NULL || cache_max_age == 0) {
+        return SUCCESS;
+    }
+    
+    uint32_t now {millis()}, status {SUCCESS};
+    for (uint32_t i {0}; i < cache_count && status == SUCCESS; ++i) {
+        if (cache_lines[i].page_address && now - cache_lines[i].dirty_since >= cache_max_age) {
+            status = cacheevict(cache_lines[i].page_address, cache_lines[i].page_address, true);
+        }
+    }
+    return status;
+}
+
+/*
+ * cachefind: Find the cache line holding a page
+ *  page_address - Page aligned flash address
+ * Returns the line or NULL if the page is not cached
+ */
+FlashCacheLine *FlashTools::cachefind(uint32_t page_address) {
+    for (uint32_t i {0}; i < cache_count; ++i) {
+        if (cache_lines[i].page_address == page_address) {
+            return &cache_lines[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * cachealloc: Allocate a line for a page and load it from flash. If no line is free, the line dirty the longest
+ * is written back and reused.
+ *  page_address - Page aligned flash address
+ * Returns the line or NULL if writing back the reused line failed
+ */
+FlashCacheLine *FlashTools::cachealloc(uint32_t page_address) {
+    
+    FlashCacheLine *line {cachefind(0)};
+    if (line == NULL) {
+        line = &cache_lines[0];
+        for (uint32_t i {1}; i < cache_count; ++i) {
+            if (static_cast<int32_t>(cache_lines[i].dirty_since - line->dirty_since) < 0) {
+                line = &cache_lines[i];
+            }
+        }
+        if (cacheevict(line->page_address, line->page_address, true) != SUCCESS) {
+            return NULL;
+        }
+    }
+    
+    flashWordCopy(line->data, reinterpret_cast<const void *>(page_address), IFLASH_WORDS_PER_PAGE);
+    line->page_address = page_address;
+    line->dirty_since  = millis();
+    return line;
+}
+
+/*
+ * cachewrite: Copies data into the cache lines of the pages it covers, then applies the timed flush policy
+ *  addr - Flash address (range already validated)
+ *  data - Data to be written
+ *  size - Size of data in bytes
+ * Returns 0 if successful or Flash Status Register error flags if a line could not be written back
+ */
+uint32_t FlashTools::cachewrite(uint32_t addr, const void *data, uint32_t size) {
+    
+    const uint8_t *src {reinterpret_cast<const uint8_t *>(data)};
+    for (uint32_t write_size; size > 0; size -= write_size, addr += write_size, src += write_size) {
+        
+        uint32_t offset {(addr - IFLASH_ADDR) % IFLASH_PAGE_SIZE};
+        write_size = IFLASH_PAGE_SIZE - offset < size ? IFLASH_PAGE_SIZE - offset : size;
+        
+        FlashCacheLine *line {cachefind(addr - offset)};
+        if (line == NULL && (line = cachealloc(addr - offset)) == NULL) {
+            return ERROR;
+        }
+        memcpy(reinterpret_cast<uint8_t *>(line->data) + offset, src, write_size);
+    }
+    
+    return flushExpired();
+}
+
+/*
+ * cacheread: Copies data from flash, taking bytes of cached pages from their cache lines
+ *  addr - Flash address
+ *  dst  - Destination buffer
+ *  size - Size of data in bytes
+ */
+void FlashTools::cacheread(uint32_t addr, void *dst, uint32_t size) {
+    
+    uint8_t *dest {reinterpret_cast<uint8_t *>(dst)};
+    for (uint32_t read_size; size > 0; size -= read_size, addr += read_size, dest += read_size) {
+        
+        uint32_t offset {(addr - IFLASH_ADDR) % IFLASH_PAGE_SIZE};
+        read_size = IFLASH_PAGE_SIZE - offset < size ? IFLASH_PAGE_SIZE - offset : size;
+        
+        FlashCacheLine *line {cachefind(addr - offset)};
+        memcpy(dest, line != NULL ? reinterpret_cast<const uint8_t *>(line->data) + offset
+                                  : reinterpret_cast<const uint8_t *>(addr), read_size);
+    }
+}
+
+/*
+ * cacheevict: Frees the cache lines of all pages within an address range, optionally writing them back first
+ *  start_addr - Start flash address
+ *  end_addr   - End flash address
+ *  write_back - true to program the lines before freeing them, false to discard them
+ * Returns 0 if successful or Flash Status Register error flags of the first failed page (that line stays cached)
+ */
+uint32_t FlashTools::cacheevict(uint32_t start_addr, uint32_t end_addr, bool write_back) {
+    
+    uint32_t status {SUCCESS};
+    for (uint32_t i {0}; i < cache_count; ++i) {
+        
+        FlashCacheLine &line {cache_lines[i]};
+        if (!line.page_address || line.page_address > end_addr || line.page_address + IFLASH_PAGE_SIZE <= start_addr) {
+            continue;
+        }
+        
+        if (write_back) {
+            const FlashIovec page {line.page_address, line.data, IFLASH_PAGE_SIZE};
+            uint32_t page_status {writev(&page, 1)};
+            if (page_status != SUCCESS) {
+                status = status != SUCCESS ? status : page_status;
+                continue;
+            }
+        }
+        line.page_address = 0;
+    }
+    return status;
+}
+
+/*
+ * writev: Writes several segments to flash. Segments are sorted by address and merged by page, so each touched
+ * page is staged once and gets a single EFC command. Where segments overlap, the one later in iov wins.
+ *  iov   - Array of segments (address, data, size); addresses may have any alignment
+ *  count - Number of segments (at most FLASH_IOVEC_MAX)
+ *  erase - Optional, default = true. Erase pages before writing
+ *  lock  - Optional, default = false. Lock pages after writing
+ * Returns 0 if successful, invalid code on bad arguments, or Flash Status Register error flag / TIMEOUT
+ */
+uint32_t FlashTools::writev(const FlashIovec *iov, uint32_t count, bool erase, bool lock) {
+    
+    /* Validate segments, then unlock their flash regions */
+    if (iov == NULL || count == 0 || count > FLASH_IOVEC_MAX) {
+        return INVALID;
+    }
+    for (uint32_t i {0}; i < count; ++i) {
+        if (iov[i].data == NULL || iov[i].addr < IFLASH_ADDR
+            || iov[i].addr >= IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE
+            || iov[i].size > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - iov[i].addr) {
+            return INVALID;
+        }
+    }
+    /* Flash bank 1 (EFC1 and its latch) belongs to the asynchronous queue until it is empty */
+    for (uint32_t i {0}; i < count; ++i) {
+        if (iov[i].size && iov[i].addr + iov[i].size > IFLASH1_ADDR && asyncBusy()) {
+            return ERROR;
+        }
+    }
+    for (uint32_t i {0}; i < count; ++i) {
+        if (iov[i].size && islocked(iov[i].addr, iov[i].addr + iov[i].size - 1)
+            && unlock(iov[i].addr, iov[i].addr + iov[i].size - 1) != SUCCESS) {
+            return ERROR;
+        }
+    }
+    
+    /* Sort segment indices by address (insertion sort, stable) */
+    uint8_t order[FLASH_IOVEC_MAX];
+    for (uint32_t i {0}; i < count; ++i) {
+        uint32_t j {i};
+        for (; j > 0 && iov[order[j - 1]].addr > iov[i].addr; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    
+    uint32_t status {SUCCESS};
+    
+    /* Visit touched pages in ascending order. next_page is the lowest page at or after page_address that still
+       has data from any segment                                                                              */
+    for (uint32_t page_address {IFLASH_ADDR}; status == SUCCESS; page_address += IFLASH_PAGE_SIZE) {
+        
+        uint32_t next_page {IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE};
+        for (uint32_t i {0}; i < count; ++i) {
+            const FlashIovec &seg {iov[order[i]]};
+            if (seg.addr >= next_page) {
+                break;  // Remaining segments start even later
+            }
+            if (seg.size && seg.addr + seg.size > page_address) {
+                uint32_t start {seg.addr > page_address ? seg.addr : page_address};
+                start -= (start - IFLASH_ADDR) % IFLASH_PAGE_SIZE;
+                next_page = start < next_page ? start : next_page;
+            }
+        }
+        if (next_page > IFLASH_LAST_PAGE_ADDRESS) {
+            break;
+        }
+        page_address = next_page;
+        
+        // Collect the segments overlapping this page in iov order, so later segments are applied last
+        uint8_t segs[FLASH_IOVEC_MAX];
+        uint32_t seg_count {0};
+        for (uint32_t i {0}; i < count; ++i) {
+            if (iov[i].size && iov[i].addr < page_address + IFLASH_PAGE_SIZE && iov[i].addr + iov[i].size > page_address) {
+                segs[seg_count++] = i;
+            }
+        }
+        
+        // Select the page's EFC, then stage the page once and send one command
+        uint32_t page_num {(page_address - IFLASH_ADDR) / IFLASH_PAGE_SIZE};
+        efc = efc_bank[page_num < IFLASH_NB_OF_PAGES ? 0 : 1];
+        status = pagecmd(page_num % IFLASH_NB_OF_PAGES, flashcpyv(pageimage(page_address), page_address, iov, segs, seg_count), erase, lock);
+    }
+    
+    return status;
+}
+
+/*
+ * writeInterleaved: Writes data striped across both flash banks, one page at a time: even pages of data go to
+ * flash bank 0 starting at addr0, odd pages to flash bank 1 starting at addr1. While one EFC programs a page, the
+ * CPU fills the other bank's latch buffer and starts it, so both controllers program at the same time.
+ * Runs from RAM with interrupts masked since flash bank 0 is busy during the write; data must be located in RAM.
+ *  addr0 - Page aligned flash bank 0 address for even pages
+ *  addr1 - Page aligned flash bank 1 address for odd pages
+ *  data  - Pointer to data buffer (RAM) containing data to be written
+ *  size  - Size of data buffer in bytes
+ * Returns 0 if successful, invalid code on bad arguments, or Flash Status Register error flags / TIMEOUT
+ */
+__attribute__ ((noinline, section(".ramfunc"))) uint32_t FlashTools::writeInterleaved(uint32_t addr0, uint32_t addr1,
+                                                                                      const void *data, uint32_t size) {
+    
+    /* Pages in each bank: bank 0 gets the extra page when the page count is odd. Check size first so the
+       page count cannot wrap */
+    if (size > IFLASH_TOTAL_PAGES * IFLASH_PAGE_SIZE) {
+        return INVALID;
+    }
+    const uint32_t PAGES {(size + IFLASH_PAGE_SIZE - 1) / IFLASH_PAGE_SIZE};
+    const uint32_t BANK_SIZE[2] {((PAGES + 1) / 2) * IFLASH_PAGE_SIZE, (PAGES / 2) * IFLASH_PAGE_SIZE};
+    
+    /* Validate addresses: page aligned and both stripes within their flash bank */
+    if (data == NULL || size == 0 || addr0 % IFLASH_PAGE_SIZE || addr1 % IFLASH_PAGE_SIZE
+        || addr0 < IFLASH0_ADDR || addr0 > IFLASH1_ADDR || BANK_SIZE[0] > IFLASH1_ADDR - addr0
+        || addr1 < IFLASH1_ADDR || addr1 > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE
+        || BANK_SIZE[1] > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - addr1) {
+        return INVALID;
+    }
+    
+    /* EFC1 belongs to the asynchronous queue until it is empty */
+    if (async_head != async_tail) {
+        return ERROR;
+    }
+    
+    /* Unlock both stripes before starting -- these are blocking commands */
+    if ((islocked(addr0, addr0 + BANK_SIZE[0] - 1) && unlock(addr0, addr0 + BANK_SIZE[0] - 1) != SUCCESS)
+        || (BANK_SIZE[1] && islocked(addr1, addr1 + BANK_SIZE[1] - 1) && unlock(addr1, addr1 + BANK_SIZE[1] - 1) != SUCCESS)) {
+        return ERROR;
+    }
+    
+    /* No constant tables below: the compiler may place them in .rodata (flash bank 0), which cannot be read
+       while EFC0 is programming. Per-bank values are selected with conditionals instead */
+    const uint8_t *src {reinterpret_cast<const uint8_t *>(data)};
+    uint32_t status {SUCCESS};
+    
+    /* Mask interrupts (handlers live in flash bank 0), then set wait states on both EFCs */
+    uint32_t primask {__get_PRIMASK()};
+    __disable_irq();
+    uint32_t fmr[2] {EFC0->EEFC_FMR, EFC1->EEFC_FMR};
+    EFC0->EEFC_FMR = (fmr[0] & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+    EFC1->EEFC_FMR = (fmr[1] & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+    
+    /* Alternate between the banks one page at a time */
+    for (uint32_t page {0}, done {0}; done < size && status == SUCCESS; ++page) {
+        
+        const uint32_t BANK {page & 1};
+        EfcInstance *bank_efc {BANK ? EFC1 : EFC0};
+        uint32_t page_address {(BANK ? addr1 : addr0) + (page >> 1) * IFLASH_PAGE_SIZE};
+        uint32_t write_size {size - done < IFLASH_PAGE_SIZE ? size - done : IFLASH_PAGE_SIZE};
+        
+        // Wait for this bank's previous page to finish. The last status read holds its error flags
+        uint32_t stat, polls;
+        for (polls = cmd_timeout, stat = bank_efc->EEFC_FSR; !(stat & EEFC_FSR_FRDY) && polls; --polls, stat = bank_efc->EEFC_FSR);
+        if (!(stat & EEFC_FSR_FRDY) || (stat & EEFC_ERROR_FLAGS)) {
+            status = (stat & EEFC_FSR_FRDY) ? (stat & EEFC_ERROR_FLAGS) : TIMEOUT;
+            break;
+        }
+        
+        // Fill the latch one word at a time. Bytes past the end of data keep the current flash contents
+        uint32_t *flash {reinterpret_cast<uint32_t *>(page_address)};
+        uint32_t changed {0}, set_bits {0};
+        for (uint32_t w {0}, b {0}; w < IFLASH_WORDS_PER_PAGE; ++w, b += IFLASH_WORD_SIZE) {
+            uint32_t old_word {flash[w]}, new_word {old_word};
+            for (uint32_t i {0}; i < IFLASH_WORD_SIZE && b + i < write_size; ++i) {
+                new_word = (new_word & ~(0xFFu << (8 * i))) | (static_cast<uint32_t>(src[done + b + i]) << (8 * i));
+            }
+            changed  |= old_word ^ new_word;
+            set_bits |= ~old_word & new_word;
+            flash[w] = new_word;
+        }
+        done += write_size;
+        
+        // Start programming this page, unless flash already holds it
+        if (!changed) {
+            ++write_stats.pages_skipped;
+            continue;
+        }
+        EEFC_FCR_Type fcr;
+        fcr.FULL = 0;
+        fcr.SECTION.FCMD = (auto_erase && !set_bits) ? EFC_FCMD_WP : EFC_FCMD_EWP;
+        fcr.SECTION.FARG = (page_address - (BANK ? IFLASH1_ADDR : IFLASH0_ADDR)) / IFLASH_PAGE_SIZE;
+        fcr.SECTION.FKEY = FWP_KEY;
+        bank_efc->EEFC_FCR = fcr.FULL;
+        ++write_stats.pages_programmed;
+        if (auto_erase && !set_bits) {
+            ++write_stats.erases_skipped;
+        }
+    }
+    
+    /* Wait for both banks to finish their last page */
+    for (uint32_t bank {0}; bank < 2; ++bank) {
+        EfcInstance *bank_efc {bank ? EFC1 : EFC0};
+        uint32_t stat, polls;
+        for (polls = cmd_timeout, stat = bank_efc->EEFC_FSR; !(stat & EEFC_FSR_FRDY) && polls; --polls, stat = bank_efc->EEFC_FSR);
+        if (status == SUCCESS) {
+            status = (stat & EEFC_FSR_FRDY) ? (stat & EEFC_ERROR_FLAGS) : TIMEOUT;
+        }
+    }
+    
+    /* Restore wait states and interrupts */
+    EFC0->EEFC_FMR = fmr[0];
+    EFC1->EEFC_FMR = fmr[1];
+    __set_PRIMASK(primask);
+    
+    return status;
+}
+
+/*
+ * readInterleaved: Reads data written by writeInterleaved back into a contiguous buffer
+ *  addr0 - Page aligned flash bank 0 address of the even pages
+ *  addr1 - Page aligned flash bank 1 address of the odd pages
+ *  dst   - Destination buffer
+ *  size  - Size of data to be read in bytes
+ * Returns 0 if successful or invalid code on bad arguments
+ */
+uint32_t FlashTools::readInterleaved(uint32_t addr0, uint32_t addr1, void *dst, uint32_t size) {
+    
+    if (size > IFLASH_TOTAL_PAGES * IFLASH_PAGE_SIZE) {
+        return INVALID;
+    }
+    const uint32_t PAGES {(size + IFLASH_PAGE_SIZE - 1) / IFLASH_PAGE_SIZE};
+    if (dst == NULL || addr0 % IFLASH_PAGE_SIZE || addr1 % IFLASH_PAGE_SIZE
+        || addr0 < IFLASH0_ADDR || addr0 > IFLASH1_ADDR || ((PAGES + 1) / 2) * IFLASH_PAGE_SIZE > IFLASH1_ADDR - addr0
+        || addr1 < IFLASH1_ADDR || addr1 > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE
+        || (PAGES / 2) * IFLASH_PAGE_SIZE > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - addr1) {
+        return INVALID;
+    }
+    
+    uint8_t *dest {reinterpret_cast<uint8_t *>(dst)};
+    for (uint32_t page {0}, done {0}, read_size; done < size; ++page, done += read_size) {
+        read_size = size - done < IFLASH_PAGE_SIZE ? size - done : IFLASH_PAGE_SIZE;
+        memcpy(dest + done, reinterpret_cast<const void *>(((page & 1) ? addr1 : addr0) + (page >> 1) * IFLASH_PAGE_SIZE), read_size);
+    }
+    return SUCCESS;
+}
+
+/*
+ * readBlock: Reads a block of flash into a buffer. The range is validated once; the bulk of the block is copied with
+ * word bursts (flashWordCopy). Pages with pending writes in the page cache are read from their cache lines.
+ *  addr - Flash address to be read (any alignment)
+ *  dst  - Destination buffer
+ *  len  - Size of data to be read in bytes
+ * Returns 0 if successful or invalid code if the range is out of bounds
+ */
+uint32_t FlashTools::readBlock(uint32_t addr, void *dst, uint32_t len) {
+    
+    const uint32_t FLASH_END {IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE};
+    if (dst == NULL || addr < IFLASH_ADDR || addr > FLASH_END || len > FLASH_END - addr) {
+        return INVALID;
+    } else if (cache_lines != NULL) {
+        cacheread(addr, dst, len);
+        return SUCCESS;
+    }
+    
+    /* Copy leading bytes until the destination is word aligned */
+    uint8_t *dest {reinterpret_cast<uint8_t *>(dst)};
+    const uint8_t *src {reinterpret_cast<const uint8_t *>(addr)};
+    for (; len > 0 && reinterpret_cast<uintptr_t>(dest) & 3; --len) {
+        *dest++ = *src++;
+    }
+    
+    /* Word bursts, then trailing bytes */
+    const uint32_t WORDS {len / 4};
+    flashWordCopy(reinterpret_cast<uint32_t *>(dest), src, WORDS);
+    memcpy(dest + 4 * WORDS, src + 4 * WORDS, len % 4);
+    
+    return SUCCESS;
+}
+
+/*
+ * writeAsync: Queue a write to flash bank 1 that is programmed one page at a time from the EFC ready (FRDY) interrupt.
+ * The library does not define the EFC interrupt handler; the sketch must forward it:
+ *     void EFC1_Handler(void) { FlashTools::asyncHandler(1); }
+ * The call returns immediately; the CPU keeps running while each page is programmed. The engine and the interrupt
+ * handlers execute from flash bank 0, so jobs may only target flash bank 1. While asyncBusy() is true, blocking
+ * writes and commands that use EFC1 (write, writev, writeInterleaved, lock, unlock, ...) return the error code. Locked regions are not unlocked; writing to them completes the job with the lock error flag.
+ *  addr     - Flash bank 1 address for write to occur (word aligned)
+ *  data     - Data buffer to be written; must stay valid until the callback is called
+ *  size     - Size of data buffer in bytes
+ *  callback - Optional. Called from the EFC1 interrupt with addr and 0 or error flags when the job finishes
+ * Returns 0 if queued, invalid code on bad arguments, or error code if the queue is full
+ */
+uint32_t FlashTools::writeAsync(uint32_t addr, const void *data, uint32_t size, FlashAsyncCallback callback) {
+    
+    /* Validate flash address range: flash bank 1 only, since the engine runs from flash bank 0 */
+    const uint32_t END {IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE};
+    if (data == NULL || size == 0 || addr & 3 || addr < IFLASH1_ADDR || addr >= END || size > END - addr) {
+        return INVALID;
+    }
+    
+    /* Add job to the queue with interrupts masked */
+    uint32_t primask {__get_PRIMASK()};
+    __disable_irq();
+    
+    uint32_t depth {async_tail - async_head};
+    if (depth == FLASH_ASYNC_QUEUE_DEPTH) {
+        ++async_stats.rejected;
+        __set_PRIMASK(primask);
+        return ERROR;
+    }
+    
+    AsyncJob *job {&async_queue[async_tail % FLASH_ASYNC_QUEUE_DEPTH]};
+    job->addr       = addr;
+    job->data       = reinterpret_cast<const uint8_t *>(data);
+    job->size       = size;
+    job->done       = 0;
+    job->pending    = 0;
+    job->auto_erase = auto_erase;
+    job->callback   = callback;
+    ++async_tail;
+    
+    ++async_stats.queued;
+    if (depth + 1 > async_stats.max_depth) {
+        async_stats.max_depth = depth + 1;
+    }
+    
+    /* Queue was idle: start the job from the EFC1 interrupt, so the callback is never called from thread context
+       (even when every page of the job is unchanged and no EFC command is needed). Jobs queued by a callback are
+       started by the handler that called it */
+    if (depth == 0 && !async_in_handler) {
+        NVIC_EnableIRQ(EFC1_IRQn);
+        NVIC_SetPendingIRQ(EFC1_IRQn);
+    }
+    
+    __set_PRIMASK(primask);
+    return SUCCESS;
+}
+
+/*
+ * asyncBusy: Check if asynchronous writes are queued or in progress
+ * Returns true if the queue is not empty
+ */
+bool FlashTools::asyncBusy(void) {
+    return async_tail != async_head;
+}
+
+/*
+ * getAsyncStats: Get the asynchronous write statistics, including the current queue depth
+ * Returns copy of asynchronous write statistics
+ */
+FlashAsyncStats FlashTools::getAsyncStats(void) {
+    FlashAsyncStats stats {async_stats};
+    stats.depth = async_tail - async_head;
+    return stats;
+}
+
+/*
+ * clearAsyncStats: Reset all asynchronous write statistics to 0
+ */
+void FlashTools::clearAsyncStats(void) {
+    uint32_t primask {__get_PRIMASK()};
+    __disable_irq();
+    async_stats = FlashAsyncStats {};
+    __set_PRIMASK(primask);
+}
+
+/*
+ * asyncStart: Stage the next page of the job at the head of the queue and start programming it with the FRDY
+ * interrupt enabled. Unchanged pages and finished jobs are handled immediately. Called from the EFC1 interrupt.
+ */
+void FlashTools::asyncStart(void) {
+    
+    while (async_head != async_tail) {
+        
+        AsyncJob *job {&async_queue[async_head % FLASH_ASYNC_QUEUE_DEPTH]};
+        
+        // Job finished: report and move on to the next job
+        if (job->done >= job->size) {
+            ++async_stats.completed;
+            ++async_head;
+            if (job->callback != NULL) {
+                job->callback(job->addr, SUCCESS);
+            }
+            continue;
+        }
+        
+        // Calculate page number, offset and write size of the next page of the job (flash bank 1)
+        uint32_t addr {job->addr + job->done};
+        uint32_t page_num   {(addr - IFLASH1_ADDR) / IFLASH_PAGE_SIZE};
+        uint32_t offset     {(addr - IFLASH1_ADDR) % IFLASH_PAGE_SIZE};
+        uint32_t write_size {IFLASH_PAGE_SIZE - offset < job->size - job->done ? IFLASH_PAGE_SIZE - offset : job->size - job->done};
+        
+        // Stage page; unchanged pages need no EFC command
+        uint32_t page_status {flashcpy(reinterpret_cast<uint32_t *>(IFLASH1_ADDR + page_num * IFLASH_PAGE_SIZE), job->data + job->done,
+                                       offset, write_size, IFLASH_PAGE_SIZE - offset - write_size)};
+        if (page_status == PAGE_UNCHANGED) {
+            ++async_stats.pages_skipped;
+            job->done += write_size;
+            continue;
+        }
+        
+        // Raise wait states on the page's EFC, enable the ready interrupt and start the page program
+        asyncSetEFC(EFC1);
+        job->pending = write_size;
+        
+        EEFC_FCR_Type fcr;
+        fcr.FULL = 0;
+        fcr.SECTION.FCMD = (job->auto_erase && page_status == PAGE_PROGRAM) ? EFC_FCMD_WP : EFC_FCMD_EWP;
+        fcr.SECTION.FARG = page_num;
+        fcr.SECTION.FKEY = FWP_KEY;
+        async_efc->EEFC_FCR = fcr.FULL;
+        async_efc->EEFC_FMR |= EEFC_FMR_FRDY;
+        return;
+    }
+    
+    // Queue empty: restore wait states
+    asyncSetEFC(NULL);
+}
+
+/*
+ * asyncSetEFC: Make next the EFC used by the asynchronous queue. Restores the wait states of the previous EFC
+ * and raises the wait states of the next one.
+ *  next - EFC instance, or NULL when the queue is idle
+ */
+void FlashTools::asyncSetEFC(EfcInstance *next) {
+    if (async_efc == next) {
+        return;
+    }
+    if (async_efc != NULL) {
+        async_efc->EEFC_FMR = (async_efc->EEFC_FMR & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(async_fws);
+    }
+    if (next != NULL) {
+        async_fws = (next->EEFC_FMR & EEFC_FMR_FWS_Msk) >> EEFC_FMR_FWS_Pos;
+        next->EEFC_FMR = (next->EEFC_FMR & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+    }
+    async_efc = next;
+}
+
+/*
+ * asyncHandler: EFC ready interrupt service. Completes the page in progress and starts the next one. When no page
+ * is in progress, the interrupt was pended by writeAsync to start an idle queue.
+ *  efc_idx - Index of the interrupting EFC (0 or 1)
+ */
+void FlashTools::asyncHandler(uint32_t efc_idx) {
+    
+    EfcInstance *irq_efc {!efc_idx ? EFC0 : EFC1};
+    
+    /* FRDY interrupt is level triggered -- disable it before anything else */
+    irq_efc->EEFC_FMR &= ~EEFC_FMR_FRDY;
+    if (efc_idx != 1 || async_head == async_tail) {
+        return;
+    }
+    
+    /* Page in progress: if EFC1 is still programming (the interrupt was pended while a page was started), wait for
+       the next FRDY interrupt without changing the job */
+    AsyncJob *job {&async_queue[async_head % FLASH_ASYNC_QUEUE_DEPTH]};
+    uint32_t stat {job->pending != 0 ? irq_efc->EEFC_FSR : EEFC_FSR_FRDY};
+    if (!(stat & EEFC_FSR_FRDY)) {
+        irq_efc->EEFC_FMR |= EEFC_FMR_FRDY;
+        return;
+    }
+    
+    /* Callbacks may queue new jobs; asyncStart picks them up, so writeAsync must not pend the interrupt meanwhile */
+    async_in_handler = true;
+    
+    /* Complete the page. Reading the status register cleared the error flags */
+    if (job->pending != 0) {
+        uint32_t status {stat & EEFC_ERROR_FLAGS};
+        if (status != SUCCESS) {
+            ++async_stats.failed;
+            ++async_head;
+            if (job->callback != NULL) {
+                job->callback(job->addr, status);
+            }
+        } else {
+            ++async_stats.pages_programmed;
+            job->done += job->pending;
+            job->pending = 0;
+        }
+    }
+    
+    asyncStart();
+    async_in_handler = false;
+}
+
+/*
+ * MPUConfigureRegion - Configure a region of memory (main memory or flash) and enable the MPU
+ *  addr - memory address
  *  size - size of region
  *  region - region to configure (0-7)
  *  tex, c, b, s, ap, xn - access permission parameters - see datasheet pg. 205-209
+ * Returns 0 if successful or invalid code on bad arguments
  */
 uint32_t FlashTools::MPUConfigureRegion(uint32_t *addr, uint32_t size, uint32_t region,
                                         uint32_t tex, uint32_t c, uint32_t b, uint32_t s,
                                         uint32_t ap, uint32_t xn) {
     
-    /* Data Synchronization Barrier -- see datasheet pg. 75, 149 */
-    /* Instruction ensures effect of MPU takes place immediately at the end of context switching */
-    __DSB();
+    MpuRegionConfig config;
+    if (MPUEncodeRegion(&config, reinterpret_cast<uint32_t>(addr), size, region, tex, c, b, s, ap, xn) != SUCCESS) {
+        return INVALID;
+    }
     
-    /* Instruction Synchronization Barrier -- see datasheet pg. 75, 150 */
-    /* Instruction ensures new MPU setting takes effect immediately after programming MPU regions */
-    __ISB();
+    return MPUConfigureRegions(&config, 1);
+}
+
+/*
+ * MPUEncodeRegion - Encode the RBAR/RASR values of a region. Tables of encoded regions can be built once (e.g. per
+ * task) and programmed with MPUConfigureRegions.
+ *  config - Encoded region output
+ *  addr   - memory address (aligned down to the region size)
+ *  size   - size of region: 2^(size+1) bytes (4-31)
+ *  region - region to configure (0-7)
+ *  tex, c, b, s, ap, xn - access permission parameters - see datasheet pg. 205-209
+ *  srd    - Optional. Subregion disable mask; bit n disables the n-th eighth of the region (size >= 7); default 0
+ * Returns 0 if successful or invalid code on bad arguments
+ */
+uint32_t FlashTools::MPUEncodeRegion(MpuRegionConfig *config, uint32_t addr, uint32_t size, uint32_t region,
+                                     uint32_t tex, uint32_t c, uint32_t b, uint32_t s,
+                                     uint32_t ap, uint32_t xn, uint32_t srd) {
     
-    /* MPU CTRL Register -- see datasheet page 202 */
-    union {
-        uint32_t FULL;
-        struct {
-            uint32_t ENABLE:1;
-            uint32_t HFNMIENA:1;
-            uint32_t PRIVDEFENA:1;
-            uint32_t RESERVED0:29;
-        } SECTION;
-    } MPU_CTRL_REGISTER;
+    if (config == NULL || region >= MPU_REGIONS || size < 4 || size > 31 || srd > 0xFF || (srd && size < 7)) {
+        return INVALID;
+    }
     
     /* MPU RBAR Register -- see datasheet page 205 */
     union {
@@ -648,13 +1904,13 @@ uint32_t FlashTools::MPUConfigureRegion(uint32_t *addr, uint32_t size, uint32_t
     MPU_RBAR_REGISTER.SECTION.REGION  = region;
     MPU_RBAR_REGISTER.SECTION.VALID   = 1;
     // Region size in bytes = 2^(size+1) -- datasheet pg. 207
-    MPU_RBAR_REGISTER.SECTION.ADDRESS = ((uint32_t)addr >> 5) & (0xffffffff << (size - 4));
+    MPU_RBAR_REGISTER.SECTION.ADDRESS = (addr >> 5) & (0xffffffff << (size - 4));
     
     /* MPU Register Attribute and Size Register -- see datasheet pg. 206 */
     MPU_RASR_REGISTER.FULL           = 0;
     MPU_RASR_REGISTER.SECTION.SIZE   = size;
     MPU_RASR_REGISTER.SECTION.ENABLE = 1;
-    MPU_RASR_REGISTER.SECTION.SRD    = 0;
+    MPU_RASR_REGISTER.SECTION.SRD    = srd;
     /* See datasheet pg. 207-209 for attribute tables */
     MPU_RASR_REGISTER.SECTION.TEX = tex;
     MPU_RASR_REGISTER.SECTION.C   = c;
@@ -663,15 +1919,270 @@ uint32_t FlashTools::MPUConfigureRegion(uint32_t *addr, uint32_t size, uint32_t
     MPU_RASR_REGISTER.SECTION.AP  = ap;
     MPU_RASR_REGISTER.SECTION.XN  = xn;
     
-    /* MPU Control Register -- see datasheet pg. 202 */
+    config->rbar = MPU_RBAR_REGISTER.FULL;
+    config->rasr = MPU_RASR_REGISTER.FULL;
+    
+    return SUCCESS;
+}
+
+/*
+ * MPUConfigureRegions - Program a table of encoded regions (see MPUEncodeRegion) and enable the MPU.
+ * The MPU is disabled once for the whole table, with interrupts masked. Regions are written in bursts of 4 through
+ * the RBAR/RASR alias registers; each RBAR value selects its own region (VALID bit), so RNR is not written.
+ * Regions not in the table keep their configuration.
+ *  regions - Encoded region table
+ *  count   - Number of regions in the table (1-8)
+ * Returns 0 if successful or invalid code on bad arguments
+ */
+uint32_t FlashTools::MPUConfigureRegions(const MpuRegionConfig *regions, uint32_t count) {
+    
+    if (regions == NULL || count == 0 || count > MPU_REGIONS) {
+        return INVALID;
+    }
+    for (uint32_t i {0}; i < count; ++i) {
+        if (!(regions[i].rbar & (1u << 4)) || (regions[i].rbar & 0xF) >= MPU_REGIONS) {
+            return INVALID;
+        }
+    }
+    
+    /* MPU CTRL Register -- see datasheet page 202 */
+    union {
+        uint32_t FULL;
+        struct {
+            uint32_t ENABLE:1;
+            uint32_t HFNMIENA:1;
+            uint32_t PRIVDEFENA:1;
+            uint32_t RESERVED0:29;
+        } SECTION;
+    } MPU_CTRL_REGISTER;
+    
+    MPU_CTRL_REGISTER.FULL               = 0;
     MPU_CTRL_REGISTER.SECTION.PRIVDEFENA = 1;
     MPU_CTRL_REGISTER.SECTION.HFNMIENA   = 0;
     MPU_CTRL_REGISTER.SECTION.ENABLE     = 1;
     
-    /* Set MPU Registers */
-    mpu->RBAR = MPU_RBAR_REGISTER.FULL;
-    mpu->RASR = MPU_RASR_REGISTER.FULL;
+    uint32_t primask {__get_PRIMASK()};
+    __disable_irq();
+    
+    /* Data Memory Barrier -- see datasheet pg. 75 */
+    /* Outstanding memory accesses complete under the old MPU settings before the MPU is disabled */
+    __DMB();
+    mpu->CTRL = 0;
+    
+    /* Bursts of 4 regions: RBAR, RASR, RBAR_A1 ... RASR_A3 are consecutive, so 8 words are stored in one STM */
+    const uint32_t *src {reinterpret_cast<const uint32_t *>(regions)};
+    uint32_t bursts {count / 4};
+#if defined(__ARM_ARCH_7M__) && !defined(FLASHTOOLS_REFERENCE_KERNELS)
+    for (; bursts > 0; --bursts) {
+        volatile uint32_t *dst {&mpu->RBAR};
+        __asm__ volatile (
+            "   ldmia %[s]!, {r3, r4, r5, r6, r8, r9, r10, r12}  \n"
+            "   stmia %[d],  {r3, r4, r5, r6, r8, r9, r10, r12}  \n"
+            : [s] "+r" (src)
+            : [d] "r" (dst)
+            : "r3", "r4", "r5", "r6", "r8", "r9", "r10", "r12", "memory");
+    }
+#else
+    for (; bursts > 0; --bursts, src += 8) {
+        mpu->RBAR    = src[0];
+        mpu->RASR    = src[1];
+        mpu->RBAR_A1 = src[2];
+        mpu->RASR_A1 = src[3];
+        mpu->RBAR_A2 = src[4];
+        mpu->RASR_A2 = src[5];
+        mpu->RBAR_A3 = src[6];
+        mpu->RASR_A3 = src[7];
+    }
+#endif
+    
+    /* Remaining regions */
+    for (uint32_t i {count % 4}; i > 0; --i, src += 2) {
+        mpu->RBAR = src[0];
+        mpu->RASR = src[1];
+    }
+    
     mpu->CTRL = MPU_CTRL_REGISTER.FULL;
     
+    /* Data Synchronization Barrier -- see datasheet pg. 75, 149 */
+    /* Instruction ensures the MPU register writes complete before the next memory access */
+    __DSB();
+    
+    /* Instruction Synchronization Barrier -- see datasheet pg. 75, 150 */
+    /* Instruction ensures instructions after this point are fetched with the new MPU settings */
+    __ISB();
+    
+    __set_PRIMASK(primask);
+    
     return SUCCESS;
 }
+
+/*
+ * MPUProtectRange - Plan (see mpuPlanRegions) and program the regions covering an address range, then enable the MPU
+ *  start_addr   - First address of the range (32-byte aligned)
+ *  end_addr     - Last address of the range (end_addr + 1 32-byte aligned)
+ *  first_region - First MPU region number to use; regions first_region .. first_region + max_regions - 1 may be used
+ *  max_regions  - Maximum number of regions to use
+ *  tex, c, b, s, ap, xn - access permission parameters - see datasheet pg. 205-209
+ *  used         - Optional. Number of regions programmed
+ * Returns 0 if successful or invalid code if the range is misaligned or needs more than max_regions regions
+ */
+uint32_t FlashTools::MPUProtectRange(uint32_t start_addr, uint32_t end_addr, uint32_t first_region, uint32_t max_regions,
+                                     uint32_t tex, uint32_t c, uint32_t b, uint32_t s,
+                                     uint32_t ap, uint32_t xn, uint32_t *used) {
+    
+    if (first_region >= MPU_REGIONS) {
+        return INVALID;
+    }
+    if (max_regions > MPU_REGIONS - first_region) {
+        max_regions = MPU_REGIONS - first_region;
+    }
+    
+    MpuPlanRegion plan[MPU_REGIONS];
+    MpuRegionConfig regions[MPU_REGIONS];
+    const uint32_t COUNT {mpuPlanRegions(start_addr, end_addr, plan, max_regions)};
+    if (COUNT == 0) {
+        return INVALID;
+    }
+    
+    for (uint32_t i {0}; i < COUNT; ++i) {
+        MPUEncodeRegion(&regions[i], plan[i].addr, plan[i].size, first_region + i, tex, c, b, s, ap, xn, plan[i].srd);
+    }
+    
+    if (used != NULL) {
+        *used = COUNT;
+    }
+    return MPUConfigureRegions(regions, COUNT);
+}
+
+/*
+ * mpuPlanRegions - Computes the smallest set of MPU regions covering exactly the range start_addr..end_addr.
+ * Regions of 256 bytes and more are split into 8 subregions that can be disabled, so a region may start before or
+ * end after the range. Greedy furthest reach: from the first uncovered address, the region size whose enabled
+ * subregions reach furthest is chosen; this is optimal since every cover must include a region holding that address.
+ *  start_addr  - First address of the range (32-byte aligned)
+ *  end_addr    - Last address of the range (end_addr + 1 32-byte aligned)
+ *  plan        - Planned regions output (max_regions entries)
+ *  max_regions - Maximum number of regions (at most 8)
+ * Returns the number of planned regions, or 0 if the range is misaligned or needs more than max_regions regions
+ */
+uint32_t mpuPlanRegions(uint32_t start_addr, uint32_t end_addr, MpuPlanRegion *plan, uint32_t max_regions) {
+    
+    const uint64_t END {static_cast<uint64_t>(end_addr) + 1};
+    if (plan == NULL || end_addr < start_addr || start_addr % 32 || END % 32) {
+        return 0;
+    }
+    
+    uint32_t count {0};
+    for (uint64_t cursor {start_addr}; cursor < END; ++count) {
+        
+        if (count == max_regions || count == MPU_REGIONS) {
+            return 0;
+        }
+        
+        /* Region sizes 2^5 .. 2^32 bytes (RASR SIZE 4 .. 31) */
+        uint64_t best_reach {cursor};
+        for (uint32_t order {5}; order <= 32; ++order) {
+            
+            const uint64_t SIZE {1ull << order};
+            const uint64_t SUB  {order >= 8 ? SIZE / 8 : SIZE};
+            const uint64_t BASE {cursor & ~(SIZE - 1)};
+            if (cursor % SUB) {
+                continue;    /* No subregion of this size starts at cursor */
+            }
+            
+            /* Enable subregions from the one at cursor up to the last one ending within the range */
+            const uint64_t LIMIT {BASE + SIZE < END ? BASE + SIZE : END};
+            const uint64_t REACH {BASE + ((LIMIT - BASE) / SUB) * SUB};
+            if (REACH > best_reach) {
+                best_reach = REACH;
+                plan[count].addr = static_cast<uint32_t>(BASE);
+                plan[count].size = order - 1;
+                plan[count].srd  = order >= 8 ? static_cast<uint32_t>(0xFF & ~(((1u << ((REACH - BASE) / SUB)) - 1)
+                                                                                 & ~((1u << ((cursor - BASE) / SUB)) - 1)))
+                                               : 0;
+            }
+        }
+        
+        cursor = best_reach;
+    }
+    
+    return count;
+}
+
+/*
+ * FlashSession Constructor: Opens a batch of flash writes. Sets 6 wait states on both EFCs, unlocks every locked
+ * region between start_addr and end_addr, and optionally masks interrupts until the session is destroyed.
+ *  flash_tools - FlashTools object used for the writes
+ *  start_addr  - Start flash address of the writes
+ *  end_addr    - End flash address of the writes
+ *  mask_irq    - Optional, default = false. Mask interrupts for the lifetime of the session
+ */
+FlashSession::FlashSession(FlashTools &flash_tools, uint32_t start_addr, uint32_t end_addr, bool mask_irq)
+    : flash(flash_tools), primask(__get_PRIMASK()), irq_masked(mask_irq), open_status(SUCCESS) {
+    
+    relock[0] = relock[1] = 0;
+    
+    /* Mask interrupts */
+    if (irq_masked) {
+        __disable_irq();
+    }
+    
+    /* Set wait states on both EFCs */
+    fmr[0] = EFC0->EEFC_FMR;
+    fmr[1] = EFC1->EEFC_FMR;
+    EFC0->EEFC_FMR = (fmr[0] & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+    EFC1->EEFC_FMR = (fmr[1] & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(CHIP_FLASH_WAIT_STATE);
+    ++flash.session_depth;
+    
+    /* Remember which regions in range are locked, then unlock them */
+    if (start_addr < IFLASH_ADDR || end_addr < start_addr || end_addr > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - 1) {
+        open_status = INVALID;
+        return;
+    }
+    if (flash.islocked(start_addr, end_addr)) {
+        for (uint32_t bank {0}; bank < 2; ++bank) {
+            const uint32_t BANK_START {bank ? IFLASH1_ADDR : IFLASH0_ADDR};
+            const uint32_t BANK_END   {BANK_START + IFLASH0_SIZE - 1};
+            if (start_addr > BANK_END || end_addr < BANK_START) {
+                continue;
+            }
+            uint32_t start_region {((start_addr > BANK_START ? start_addr : BANK_START) - BANK_START) / IFLASH_LOCK_REGION_SIZE};
+            uint32_t end_region   {((end_addr   < BANK_END   ? end_addr   : BANK_END)   - BANK_START) / IFLASH_LOCK_REGION_SIZE};
+            relock[bank] = flash.lock_bits[bank] & ((2u << end_region) - 1) & ~((1u << start_region) - 1);
+        }
+        open_status = flash.unlock(start_addr, end_addr);
+    }
+}
+
+/*
+ * FlashSession Destructor: Re-locks the regions unlocked by the session, restores the wait states of both EFCs
+ * and restores the interrupt mask.
+ */
+FlashSession::~FlashSession(void) {
+    
+    /* Re-lock regions that were locked when the session was opened */
+    for (uint32_t bank {0}; bank < 2; ++bank) {
+        for (uint32_t region {0}; relock[bank] >> region; ++region) {
+            if (relock[bank] & (1u << region)) {
+                uint32_t addr {(bank ? IFLASH1_ADDR : IFLASH0_ADDR) + region * IFLASH_LOCK_REGION_SIZE};
+                flash.lock(addr, addr);
+            }
+        }
+    }
+    
+    /* Restore wait states and interrupts */
+    --flash.session_depth;
+    EFC0->EEFC_FMR = fmr[0];
+    EFC1->EEFC_FMR = fmr[1];
+    if (irq_masked) {
+        __set_PRIMASK(primask);
+    }
+}
+
+/*
+ * status: Get the result of opening the session
+ * Returns 0 if successful, invalid code on a bad address range, or Flash Status Register error flags from unlocking
+ */
+uint32_t FlashSession::status(void) {
+    return open_status;
+}
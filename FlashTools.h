@@ -90,12 +90,19 @@ typedef struct {
 #define IFLASH_LOCK_REGION_PAGES (64u)                          /* Pages per lock region */
 #define IFLASH_WORD_SIZE         (sizeof(uint32_t))             /* Word size */
 #define IFLASH_LOCK_REGION_SIZE  (IFLASH_PAGE_SIZE * IFLASH_LOCK_REGION_PAGES)      /* Lock region size */
+#define IFLASH_LOCK_REGIONS      (IFLASH_NB_OF_PAGES / IFLASH_LOCK_REGION_PAGES)    /* Lock regions per flash bank */
 #define IFLASH_WORDS_PER_PAGE    (IFLASH_PAGE_SIZE / IFLASH_WORD_SIZE)              /* Max words per flash page */
 #define IFLASH_LAST_PAGE_ADDRESS (IFLASH1_ADDR + IFLASH1_SIZE - IFLASH_PAGE_SIZE)   /* Flash last page address */
-#define IFLASH_TOTAL_PAGES       (IFLASH0_NB_OF_PAGES + IFLASH1_NB_OF_PAGES)        /* Total number of pages */
+#define IFLASH_TOTAL_PAGES       (2 * IFLASH_NB_OF_PAGES)                           /* Total number of pages (both banks) */
 #define CHIP_FLASH_WAIT_STATE    (6u)                                               /* Wait states for flash oeprations */
+#define FLASH_CMD_TIMEOUT        (1000000u)                                         /* FSR polls before a direct command times out */
 #define UNIQUE_ID_SIZE           (4u)
-#define FLASH_DESCRIPTOR_SIZE    (4u)
+#define FLASH_IOVEC_MAX          (16u)                                              /* Maximum segments per writev call */
+#ifndef FLASH_ASYNC_QUEUE_DEPTH
+#define FLASH_ASYNC_QUEUE_DEPTH  (8u)                                               /* Maximum queued asynchronous writes */
+#endif
+#define MPU_REGIONS              (8u)                                               /* MPU regions */
+#define FLASH_DESCRIPTOR_SIZE    (32u)                                              /* Maximum words of a GETD result */
 
 /* ---------------- EEFC Flash Mode Register - Datasheet pg. 311 ---------------- */
 #define EEFC_FMR_FWS_Pos      8                             /* Flash Wait State - bits 8-11 */
@@ -140,6 +147,16 @@ typedef struct {
 #define FLASH_ACCESS_MODE_128  0
 #define FLASH_ACCESS_MODE_64   EEFC_FMR_FAM
 
+/* ---------------- Flash Read Profiles ---------------- */
+#define FLASH_PROFILE_CODE     0    /* 128-bit access, sequential code optimization enabled (boot default) */
+#define FLASH_PROFILE_DATA     1    /* 64-bit access, sequential code optimization disabled */
+
+/* ---------------- Maximum Core Clock per Flash Wait State (VDDCORE 1.62V) ---------------- */
+#define FLASH_FREQ_FWS_0       (19000000u)   /* Maximum frequency with 0 wait states */
+#define FLASH_FREQ_FWS_1       (50000000u)   /* Maximum frequency with 1 wait state */
+#define FLASH_FREQ_FWS_2       (64000000u)   /* Maximum frequency with 2 wait states */
+#define FLASH_FREQ_FWS_3       (80000000u)   /* Maximum frequency with 3 wait states; above requires 4 */
+
 /* ---------------- In-Application Programming (IAP) Routine Address - Datasheet pg. 331 ---------------- */
 #define IAP_ENTRY_ADDRESS (IROM_ADDR + 8)                 
 
@@ -147,15 +164,170 @@ typedef struct {
 #define EFC0 ((EfcInstance*)EFC0_ADDR)
 #define EFC1 ((EfcInstance*)EFC1_ADDR)
 
+/* ---------------- GPNVM Bits (bit mask as returned by getGPNVM) ---------------- */
+#define GPNVM_SECURITY     (0x1u << 0)    /* Security bit; can only be cleared by asserting the ERASE pin */
+#define GPNVM_BOOT_FLASH   (0x1u << 1)    /* Boot mode select: set = boot from flash, clear = boot from ROM (SAM-BA) */
+#define GPNVM_BOOT_FLASH1  (0x1u << 2)    /* Flash select: set = boot from flash 1, clear = boot from flash 0 */
+#define GPNVM_MASK         (GPNVM_SECURITY | GPNVM_BOOT_FLASH | GPNVM_BOOT_FLASH1)
+
 /* ---------------- Return Codes ---------------- */
 typedef enum {
     SUCCESS        = 0,
     ERROR          = 0x10,
+    TIMEOUT        = 0x20,
     INVALID        = 0xFFFFFFFF,
     BIT_IS_SET     = 0x1,
     BIT_IS_CLEARED = 0,
 } ReturnCodes;
 
+/* ---------------- EFC Command Modes ---------------- */
+typedef enum {
+    CMD_MODE_IAP    = 0,       /* Commands are sent through the IAP routine in ROM */
+    CMD_MODE_DIRECT = 1,       /* Commands are written to EEFC_FCR from RAM and EEFC_FSR is polled with a timeout */
+} CommandModes;
+
+/* ---------------- Write Statistics ---------------- */
+typedef struct {
+    uint32_t pages_programmed;     /* Pages sent to the EFC with a write command */
+    uint32_t pages_skipped;        /* Pages skipped because flash already held the staged data */
+    uint32_t erases_skipped;       /* Pages programmed without erase because no bit had to go from 0 to 1 */
+} FlashWriteStats;
+
+/* ---------------- Scatter-Gather Write Segment ---------------- */
+typedef struct {
+    uint32_t addr;                 /* Flash address of the segment */
+    const void *data;              /* Data to be written */
+    uint32_t size;                 /* Size of data in bytes */
+} FlashIovec;
+
+/* ---------------- Write-Back Page Cache Line ---------------- */
+typedef struct {
+    uint32_t page_address;                    /* Cached flash page address, or 0 if the line is free */
+    uint32_t dirty_since;                     /* millis() when the line became dirty */
+    uint32_t data[IFLASH_WORDS_PER_PAGE];     /* Page contents including pending writes */
+} FlashCacheLine;
+
+/* ---------------- Asynchronous Write Statistics ---------------- */
+typedef struct {
+    uint32_t depth;                /* Jobs currently queued, including the one in progress */
+    uint32_t max_depth;            /* Highest queue depth observed */
+    uint32_t queued;               /* Jobs accepted by writeAsync */
+    uint32_t rejected;             /* Jobs rejected because the queue was full */
+    uint32_t completed;            /* Jobs finished successfully */
+    uint32_t failed;               /* Jobs finished with an EFC error */
+    uint32_t pages_programmed;     /* Pages programmed by the asynchronous engine */
+    uint32_t pages_skipped;        /* Pages skipped because flash already held the staged data */
+} FlashAsyncStats;
+
+/* Encoded MPU region: RBAR (base address, VALID, region number) and RASR values, in alias register order.
+   A region with rasr = 0 is disabled when the table is programmed.                                        */
+typedef struct {
+    uint32_t rbar;
+    uint32_t rasr;
+} MpuRegionConfig;
+
+/* Planned MPU region: base address, RASR SIZE field (2^(size+1) bytes) and subregion disable mask */
+typedef struct {
+    uint32_t addr;
+    uint32_t size;
+    uint32_t srd;
+} MpuPlanRegion;
+
+/* Flash descriptor of one bank as returned by GETD:
+   FL_ID, FL_SIZE, FL_PAGE_SIZE, FL_NB_PLANE, FL_PLANE[FL_NB_PLANE], FL_NB_LOCK, FL_LOCK[FL_NB_LOCK] */
+typedef struct {
+    uint32_t words[FLASH_DESCRIPTOR_SIZE];    /* Raw descriptor words */
+    uint32_t length;                          /* Number of words returned */
+    uint32_t lock_index;                      /* Index of FL_NB_LOCK in words */
+} FlashDescriptor;
+
+/* Asynchronous write completion callback -- called from the EFC1 interrupt with the job address and status */
+typedef void (*FlashAsyncCallback)(uint32_t addr, uint32_t status);
+
+/* ---------------- Word Kernels ---------------- */
+/* Burst (8 words per LDM/STM) copy, compare and blank check. src may be misaligned; dst/addr must be word aligned.
+   Define FLASHTOOLS_REFERENCE_KERNELS to use the portable reference loops (always used on non Cortex-M3 hosts) */
+#define FLASH_CMP_DIFFERENT  (0x1u)                          /* Compared words differ */
+#define FLASH_CMP_SETS_BITS  (0x2u)                          /* New words set at least one bit that is clear in old */
+
+void     flashWordCopy(uint32_t *dst, const void *src, uint32_t words);
+uint32_t flashWordCompare(const uint32_t *old_words, const void *new_words, uint32_t words);
+bool     flashBlankCheck(const uint32_t *addr, uint32_t words);
+
+/* ---------------- MPU Region Planner ---------------- */
+/* Covers an address range exactly with the fewest power-of-two MPU regions, using subregion disable masks.
+   Pure function (no register access); FlashTools::MPUProtectRange programs its result.                  */
+uint32_t mpuPlanRegions(uint32_t start_addr, uint32_t end_addr, MpuPlanRegion *plan, uint32_t max_regions);
+
+/* ---------------- Page Addressing ---------------- */
+/* Both banks are contiguous, so page N (0-2047) starts at IFLASH_ADDR + N * IFLASH_PAGE_SIZE in either bank.
+   The constexpr helpers are shared by the runtime (getPageAddress/getOffset) and compile-time (pageAddress/PageRef)
+   versions; with a constant page number the address folds to a constant.                                      */
+constexpr bool     flashPageValid(uint32_t page_num) { return page_num < IFLASH_TOTAL_PAGES; }
+constexpr uint32_t flashPageAddress(uint32_t page_num) { return IFLASH_ADDR + IFLASH_PAGE_SIZE * page_num; }
+constexpr uint32_t flashPageBank(uint32_t page_num) { return page_num / IFLASH_NB_OF_PAGES; }
+
+/* Address of page PageNum; pages out of range fail to compile */
+template <uint32_t PageNum>
+constexpr uint32_t pageAddress(void) {
+    static_assert(flashPageValid(PageNum), "Flash page number out of range (0-2047)");
+    return flashPageAddress(PageNum);
+}
+
+/* Compile-time reference to page PageNum; pages out of range fail to compile */
+template <uint32_t PageNum>
+struct PageRef {
+    static_assert(flashPageValid(PageNum), "Flash page number out of range (0-2047)");
+    
+    /* Linear page number, page number within its bank, bank (0 or 1), lock region within the bank and page address */
+    static constexpr uint32_t number(void) { return PageNum; }
+    static constexpr uint32_t bankPage(void) { return PageNum % IFLASH_NB_OF_PAGES; }
+    static constexpr uint32_t bank(void) { return flashPageBank(PageNum); }
+    static constexpr uint32_t lockRegion(void) { return bankPage() / IFLASH_LOCK_REGION_PAGES; }
+    static constexpr uint32_t address(void) { return flashPageAddress(PageNum); }
+    
+    /* Typed pointer into the page at an (optional) offset in sizeof(Type) */
+    template <typename Type>
+    static Type *pointer(uint32_t offset = 0) { return reinterpret_cast<Type *>(address()) + offset; }
+};
+
+/* ---------------- FlashSpan Class ---------------- */
+/* Read-only typed view of memory-mapped flash. Elements are read in place, so large constant tables need no RAM copy.
+   A span does not see writes pending in the FlashTools page cache; flush before reading through a span.       */
+template <typename Type>
+class FlashSpan {
+    
+    private:
+        const Type *first;
+        uint32_t count;
+    
+    public:
+        typedef const Type *iterator;
+    
+        /* Create a view of count elements at flash address addr (see FlashTools::getSpan for a checked factory) */
+        FlashSpan(void) : first(NULL), count(0) {}
+        FlashSpan(uint32_t addr, uint32_t elements) : first(reinterpret_cast<const Type *>(addr)), count(elements) {}
+    
+        /* Iterators and element count */
+        iterator begin(void) const { return first; }
+        iterator end(void) const { return first + count; }
+        uint32_t size(void) const { return count; }
+        bool empty(void) const { return count == 0; }
+    
+        /* Unchecked / bounds-checked element access (at returns NULL if idx is out of bounds) */
+        const Type &operator[](uint32_t idx) const { return first[idx]; }
+        const Type *at(uint32_t idx) const { return idx < count ? first + idx : NULL; }
+    
+        /* Flash address, first page number (0-2047), number of pages touched and flash bank (0 or 1) of the view */
+        uint32_t address(void) const { return reinterpret_cast<uint32_t>(first); }
+        uint32_t page(void) const { return (address() - IFLASH_ADDR) / IFLASH_PAGE_SIZE; }
+        uint32_t pages(void) const {
+            return count == 0 ? 0 : (address() + count * sizeof(Type) - 1 - IFLASH_ADDR) / IFLASH_PAGE_SIZE - page() + 1;
+        }
+        uint32_t bank(void) const { return address() >= IFLASH1_ADDR ? 1u : 0u; }
+        bool spansBanks(void) const { return count > 0 && address() < IFLASH1_ADDR && address() + count * sizeof(Type) > IFLASH1_ADDR; }
+};
+
 /* ---------------- FlashTools Class ---------------- */
 class FlashTools {
     
@@ -176,47 +348,149 @@ class FlashTools {
         MpuInstance *mpu;
         ScbInstance *scb;
     
+        /* EFC register blocks of flash bank 0 / flash bank 1 and flash image used by write(), writev(), lock(), unlock()
+           and the lock bit cache: EFC0, EFC1 and the flash itself, or an emulated model on a host */
+        EfcInstance *efc_bank[2];
+        uint8_t *flash_image;
+    
+        /* Initialize members common to both constructors / get the image of a flash page (the page latch on the device) */
+        void init(EfcInstance *efc0, EfcInstance *efc1, uint8_t *flash);
+        uint32_t *pageimage(uint32_t page_address);
+    
         /* Function pointer for the IAP routine */
         typedef uint32_t (*IAP_FPTR)(uint32_t EFCidx, uint32_t cmd);
         static IAP_FPTR IAP;
     
-        /* Flash wait state and flash access mode values for each EFC instance */
-        uint32_t FWS0, FWS1;
-        uint32_t FAM0, FAM1;
+        /* Command mode (IAP or direct) and direct mode timeout in FSR polls */
+        uint32_t cmd_mode;
+        uint32_t cmd_timeout;
+    
+        /* Number of open FlashSession objects; while > 0, wait states and unlocking are handled by the session */
+        uint32_t session_depth;
+        friend class FlashSession;
     
         /* Array for unique ID */
         uint32_t uniqueID[UNIQUE_ID_SIZE];
     
-        /* Array for flash descriptor */
-        uint32_t flash_descriptor[FLASH_DESCRIPTOR_SIZE + 1];
+        /* Cached flash descriptor of each bank, and bit mask of banks read from the EFC */
+        FlashDescriptor descriptors[2];
+        uint32_t descriptor_valid;
+        
+        /* Get the cached descriptor of the bank holding addr, reading it from the EFC on first use */
+        FlashDescriptor *descriptor(uint32_t addr);
     
-        /* Set flash wait state / set flash access mode */
-        void setfws(uint32_t fws);
-        void setfam(uint32_t fa_mode);
+        /* Page write statistics */
+        FlashWriteStats write_stats;
     
-        /* Get flash wait state / get flash access mode */
-        uint32_t getfws(void);
-        uint32_t getfam(void);
+        /* Automatic erase selection -- use WP instead of EWP when no erase is needed */
+        bool auto_erase;
+    
+        /* New page contents compared against current flash contents */
+        typedef enum {
+            PAGE_UNCHANGED = 0,    /* Flash already holds the staged page */
+            PAGE_PROGRAM   = 1,    /* Staged page only clears bits; programming without erase is enough */
+            PAGE_ERASE     = 2,    /* Staged page sets at least one bit; page must be erased first */
+        } PageStatus;
+    
+        /* Update bits of the current EFC instance's Flash Mode Register */
+        void setfmr(uint32_t mask, uint32_t value);
     
-        /* Write a command to EFC using IAP routine */
+        /* Send a GPNVM command (GPNVM bits are only accessible through EFC0) */
+        uint32_t gpnvmcmd(uint32_t command, uint32_t bit);
+    
+        /* Write a command to EFC using IAP routine or directly, depending on command mode */
         uint32_t cmd(uint32_t cmd, uint32_t arg);
     
-        /* Copy data from write_data to a page of flash */
-        uint32_t *flashcpy(uint32_t page_address, const void *write_data,
-                           uint32_t offset, uint32_t write_size, uint32_t padding_size);
+        /* Write a command value to EEFC_FCR and poll EEFC_FSR until ready or timeout */
+        uint32_t cmddirect(uint32_t fcr);
+    
+        /* Asynchronous write job and queue -- shared by all instances since the EFCs are global */
+        typedef struct {
+            uint32_t addr;                 /* Flash address of the job */
+            const uint8_t *data;           /* Data to be written; must stay valid until completion */
+            uint32_t size;                 /* Size of data in bytes */
+            uint32_t done;                 /* Bytes written so far */
+            uint32_t pending;              /* Bytes in the page currently being programmed */
+            bool auto_erase;               /* Auto erase setting of the instance that queued the job */
+            FlashAsyncCallback callback;   /* Completion callback (optional) */
+        } AsyncJob;
+        static AsyncJob async_queue[FLASH_ASYNC_QUEUE_DEPTH];
+        static volatile uint32_t async_head, async_tail;
+        static volatile bool async_in_handler;         /* asyncHandler is running (callbacks may queue jobs) */
+        static FlashAsyncStats async_stats;
+        static EfcInstance *async_efc;
+        static uint32_t async_fws;
+    
+        /* Start programming the next page of the queue / switch the EFC used by the queue */
+        static void asyncStart(void);
+        static void asyncSetEFC(EfcInstance *next);
+    
+        /* Cached lock bits (one bit per lock region) for each flash bank, and bit mask of banks read from the EFC */
+        uint32_t lock_bits[2];
+        uint32_t lock_valid;
+    
+        /* Write-back page cache (user supplied lines), line count and maximum dirty age in ms (0 = no timed flush) */
+        FlashCacheLine *cache_lines;
+        uint32_t cache_count;
+        uint32_t cache_max_age;
+    
+        /* Page cache helpers: find / allocate a line, absorb a write, read through the cache, flush and drop a range */
+        FlashCacheLine *cachefind(uint32_t page_address);
+        FlashCacheLine *cachealloc(uint32_t page_address);
+        uint32_t cachewrite(uint32_t addr, const void *data, uint32_t size);
+        void cacheread(uint32_t addr, void *dst, uint32_t size);
+        uint32_t cacheevict(uint32_t start_addr, uint32_t end_addr, bool write_back);
+    
+        /* Send the write command for a staged page to the current EFC and update statistics */
+        uint32_t pagecmd(uint32_t page_num, uint32_t page_status, bool erase, bool lock);
+    
+        /* Copy the segments covering the page at page_address to its image (page latch). Returns PageStatus */
+        static uint32_t flashcpyv(uint32_t *page, uint32_t page_address, const FlashIovec *iov, const uint8_t *segs, uint32_t seg_count);
+    
+        /* Copy data from write_data to a page image (page latch). Returns PageStatus */
+        static uint32_t flashcpy(uint32_t *page, const void *write_data,
+                          uint32_t offset, uint32_t write_size, uint32_t padding_size);
     
     public:
         /* Constructor / Destructor */
         FlashTools(void);
         ~FlashTools(void);
     
+        /* Host testing: write(), writev(), lock() and unlock() drive the given EFC register blocks and flash image
+           (2 * IFLASH_NB_OF_PAGES pages for addresses from IFLASH_ADDR) instead of the device */
+        FlashTools(EfcInstance *efc0, EfcInstance *efc1, void *flash);
+    
         /* Set EFC instance / Get EFC instance */
         uint32_t setEFC(uint32_t efc_idx);
         uint32_t getEFC(void);
     
+        /* Set flash wait state / set flash access mode of the current EFC instance (see setEFC) */
+        void setfws(uint32_t fws);
+        void setfam(uint32_t fa_mode);
+    
+        /* Get flash wait state / get flash access mode of the current EFC instance */
+        uint32_t getfws(void);
+        uint32_t getfam(void);
+    
+        /* Minimum safe wait states for a core clock / apply minimum wait states and a read profile to both EFCs */
+        static uint32_t minWaitStates(uint32_t clock_hz);
+        uint32_t tuneFlash(uint32_t profile = FLASH_PROFILE_CODE);
+    
+        /* Set/Get the EFC command mode (CMD_MODE_IAP or CMD_MODE_DIRECT) */
+        uint32_t setCommandMode(uint32_t mode);
+        uint32_t getCommandMode(void);
+    
+        /* Set/Get the direct command mode timeout in FSR polls */
+        void setCommandTimeout(uint32_t polls);
+        uint32_t getCommandTimeout(void);
+    
         /* Get the MCU's unique ID */
         uint32_t getUniqueID(uint32_t *uBuff);
     
+        /* Get all GPNVM bits with one command / change only the GPNVM bits that differ from the desired state */
+        uint32_t getGPNVM(void);
+        uint32_t applyBootConfig(uint32_t desired, uint32_t mask = GPNVM_BOOT_FLASH | GPNVM_BOOT_FLASH1);
+    
         /* Set/Get GPNVM bits */
         uint32_t setSecurityBit(void);
         uint32_t setBootModeSAMBA(void);
@@ -227,8 +501,9 @@ class FlashTools {
         uint32_t getBootSelectBit(void);
         uint32_t getFlashSelectBit(void);
     
-        /* Get flash descriptor / flash information */
+        /* Get flash descriptor / flash information (read once per bank, then served from the descriptor cache) */
         uint32_t *getFlashDescriptor(uint32_t addr);
+        uint32_t refreshFlashDescriptor(uint32_t addr);
         uint32_t getFlashId(uint32_t addr);
         uint32_t getFlashSize(uint32_t addr);
         uint32_t getPageSize(uint32_t addr);
@@ -236,9 +511,14 @@ class FlashTools {
         uint32_t getRegionSize(uint32_t addr);
         uint32_t getPageCount(uint32_t addr);
         uint32_t getPageCountPerRegion(uint32_t addr);
+        uint32_t getPlaneCount(uint32_t addr);
+        const uint32_t *getRegionTable(uint32_t addr);
     
         /* Check of region of flash is locked */
         uint32_t islocked(uint32_t start_addr, uint32_t end_addr);
+    
+        /* Re-read the lock bits of both banks into the lock bit cache */
+        uint32_t refreshLockState(void);
 
         /* Lock / unlock flash from start_addr to end_addr */
         uint32_t lock(uint32_t start_addr, uint32_t end_addr);
@@ -247,11 +527,46 @@ class FlashTools {
         /* Erase flash at addr */
         uint32_t erase(uint32_t addr);
     
+        /* Enable / disable automatic program-only writes when the erase flag is set */
+        void setAutoErase(bool enable);
+        bool getAutoErase(void);
+    
+        /* Get / clear page write statistics */
+        const FlashWriteStats &getWriteStats(void);
+        void clearWriteStats(void);
+    
+        /* Write / read a buffer striped page by page across both flash banks (EFC0 and EFC1 program concurrently) */
+        uint32_t writeInterleaved(uint32_t addr0, uint32_t addr1, const void *data, uint32_t size);
+        uint32_t readInterleaved(uint32_t addr0, uint32_t addr1, void *dst, uint32_t size);
+    
+        /* Queue a non-blocking write to flash bank 1; pages are programmed from the EFC1 ready interrupt */
+        uint32_t writeAsync(uint32_t addr, const void *data, uint32_t size, FlashAsyncCallback callback = NULL);
+        bool asyncBusy(void);
+    
+        /* Get / clear asynchronous write statistics */
+        FlashAsyncStats getAsyncStats(void);
+        void clearAsyncStats(void);
+    
+        /* EFC ready interrupt service. Not installed by the library: the sketch forwards its EFC1_Handler (and
+           EFC0_Handler, if defined) here, e.g. void EFC1_Handler(void) { FlashTools::asyncHandler(1); }        */
+        static void asyncHandler(uint32_t efc_idx);
+    
         /* Enable MPU and configure memory region */
         uint32_t MPUConfigureRegion(uint32_t *addr, uint32_t size, uint32_t region,
                                     uint32_t tex, uint32_t c, uint32_t b,
                                     uint32_t s, uint32_t ap, uint32_t xn);
     
+        /* Encode a region for MPUConfigureRegions / program a table of up to 8 regions with one MPU disable/enable */
+        static uint32_t MPUEncodeRegion(MpuRegionConfig *config, uint32_t addr, uint32_t size, uint32_t region,
+                                        uint32_t tex, uint32_t c, uint32_t b,
+                                        uint32_t s, uint32_t ap, uint32_t xn, uint32_t srd = 0);
+        uint32_t MPUConfigureRegions(const MpuRegionConfig *regions, uint32_t count);
+    
+        /* Protect an arbitrary 32-byte aligned range with as few regions as possible, starting at first_region */
+        uint32_t MPUProtectRange(uint32_t start_addr, uint32_t end_addr, uint32_t first_region, uint32_t max_regions,
+                                 uint32_t tex, uint32_t c, uint32_t b,
+                                 uint32_t s, uint32_t ap, uint32_t xn, uint32_t *used = NULL);
+    
         /* Get the adress given page number and (optional) offset a*/
         template <typename Type>
         Type *getPageAddress(uint32_t page_num, uint32_t offset);
@@ -260,119 +575,219 @@ class FlashTools {
         template <typename Type>
         uint32_t getOffset(uint32_t page_num, uint32_t offset);
     
+        /* Get a read-only typed view of flash at addr / at page number and (optional) offset */
+        template <typename Type>
+        FlashSpan<Type> getSpan(uint32_t addr, uint32_t count);
+        template <typename Type>
+        FlashSpan<Type> getPageSpan(uint32_t page_num, uint32_t count, uint32_t offset = 0);
+    
         /* Write data to flash at addr */
         template<typename Type>
         uint32_t write(uint32_t addr, Type *data, uint32_t size, bool erase, bool lock);
         template<typename Type>
         uint32_t write(Type *addr, Type *data, uint32_t size, bool erase, bool lock);
     
+        /* Enable / disable the write-back page cache in front of write() and read() */
+        uint32_t enableCache(FlashCacheLine *lines, uint32_t count, uint32_t max_dirty_age_ms = 0);
+        uint32_t disableCache(void);
+    
+        /* Program all dirty cache lines / the line holding addr / lines older than the maximum dirty age */
+        uint32_t flush(void);
+        uint32_t flushPage(uint32_t addr);
+        uint32_t flushExpired(void);
+    
+        /* Write several segments, programming each touched page once */
+        uint32_t writev(const FlashIovec *iov, uint32_t count, bool erase = true, bool lock = false);
+    
         /* Read single chunk of flash at specified address */
         template <typename Type>
         Type read(uint32_t addr);
         template <typename Type>
         Type read(Type *addr);
     
+        /* Read a block of flash into a buffer with one bounds check and word burst copies */
+        uint32_t readBlock(uint32_t addr, void *dst, uint32_t len);
+        template <typename Type>
+        uint32_t readArray(uint32_t addr, Type *dst, uint32_t count);
+        template <typename Type>
+        uint32_t readArray(const Type *addr, Type *dst, uint32_t count);
+    
+};
+
+/* ---------------- FlashSession Class ---------------- */
+/* Scoped batch of flash writes: raises the wait states of both EFCs, unlocks the lock regions of an address range
+   and optionally masks interrupts once, then restores all of it on destruction. Writes made through the
+   FlashTools object while the session is open skip their own wait state and unlock handling.               */
+class FlashSession {
+    
+    private:
+        FlashTools &flash;
+    
+        /* Saved Flash Mode Registers, lock regions unlocked by the session (per bank) and saved PRIMASK */
+        uint32_t fmr[2];
+        uint32_t relock[2];
+        uint32_t primask;
+        bool irq_masked;
+    
+        /* Result of opening the session */
+        uint32_t open_status;
+    
+        /* Sessions cannot be copied */
+        FlashSession(const FlashSession &);
+        FlashSession &operator=(const FlashSession &);
+    
+    public:
+        /* Open / close session */
+        FlashSession(FlashTools &flash_tools, uint32_t start_addr, uint32_t end_addr, bool mask_irq = false);
+        ~FlashSession(void);
+    
+        /* Get the result of opening the session (0 if successful) */
+        uint32_t status(void);
 };
 
 /*
- * getPageAddress: Returns type pointer to flash memory at the beginning of specified page
- *  page_num - Flash page number (flash bank 1: 0-1023, flash bank 2: 1024-2048)
+ * getPageAddress: Returns type pointer to flash memory at the beginning of specified page.
+ * For a constant page number use pageAddress<N>() or PageRef<N>, which are checked at compile time.
+ *  page_num - Flash page number (flash bank 0: 0-1023, flash bank 1: 1024-2047)
  *  offset (optional) - Offset of memory location in sizeof(Type); default 0
  * Returns pointer to first flash page address or NULL if page number out of bounds
  */
 template <typename Type>
 Type *FlashTools::getPageAddress(uint32_t page_num, uint32_t offset = 0) {
-    // If page number invalid, return NULL
-    if (page_num < 0 || page_num >= IFLASH_TOTAL_PAGES) {
+    if (!flashPageValid(page_num)) {
         return NULL;
     }
-    // Return address
-    // Page in flash bank 0 => bank 0 start address + (page size * page number) + offset (optional)
-    // Page in flash bank 1 => bank 1 start address + (page size * page number) + offset (optional)
-    return (page_num <= IFLASH_NB_OF_PAGES) ? reinterpret_cast<Type *>(IFLASH0_ADDR + (IFLASH_PAGE_SIZE * page_num)) + offset
-        : reinterpret_cast<Type *>(IFLASH1_ADDR + (IFLASH_PAGE_SIZE * (page_num % IFLASH_NB_OF_PAGES))) + offset;
+    return reinterpret_cast<Type *>(flashPageAddress(page_num)) + offset;
 }
 
 /*
- * getOffset: Returns the offset of the specified page in sizeof(Type) from the beginning of flash bank
- *  page_num          - Flash page number (flash bank 1: 0-1023, flash bank 2: 1024-2048)
+ * getOffset: Returns the offset of the specified page in sizeof(Type) from the beginning of flash (IFLASH0_ADDR)
+ *  page_num          - Flash page number (flash bank 0: 0-1023, flash bank 1: 1024-2047)
  *  offset (optional) - Offset of the location (in sizeof(Type)) from the beginning of the page
- * Returns the offset of specified page from start of flash bank.
- *
+ * Returns the offset of specified page from start of flash or INVALID if page number out of bounds
  */
 template <typename Type>
 uint32_t FlashTools::getOffset(uint32_t page_num, uint32_t offset = 0) {
-    // If page number invalid, return NULL
-    if (page_num < 0 || page_num >= IFLASH_TOTAL_PAGES) {
-        return NULL;
+    if (!flashPageValid(page_num)) {
+        return INVALID;
     }
-    // Return offset
-    // Page in flash bank 0 => (bank 0 size + (page size * page number) / type size) + offset (optional)
-    // Page in flash bank 1 => (bank 1 size + (page size * page number) / type size) + offset (optional)
-    return (page_num <= IFLASH_NB_OF_PAGES) ? ((IFLASH_PAGE_SIZE * page_num) / sizeof(Type)) + offset
-        : ((IFLASH0_SIZE + (IFLASH_PAGE_SIZE * page_num)) / sizeof(Type)) + offset;
+    return (flashPageAddress(page_num) - IFLASH_ADDR) / sizeof(Type) + offset;
 }
 
 /*
- * write: Unlocks flash region and writes data to it (1 page at a time)
+ * getSpan: Returns a read-only typed view of flash memory; elements are read directly from flash
+ *  addr  - Flash address of the first element (aligned to Type)
+ *  count - Number of elements in the view
+ * Returns the view, or an empty view if the range is out of bounds or misaligned
+ */
+template <typename Type>
+FlashSpan<Type> FlashTools::getSpan(uint32_t addr, uint32_t count) {
+    const uint32_t FLASH_END {IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE};
+    if (addr < IFLASH_ADDR || addr > FLASH_END || addr % __alignof__(Type) || count > (FLASH_END - addr) / sizeof(Type)) {
+        return FlashSpan<Type>();
+    }
+    return FlashSpan<Type>(addr, count);
+}
+
+/*
+ * getPageSpan: Returns a read-only typed view of flash memory starting at a page
+ *  page_num          - Flash page number (flash bank 0: 0-1023, flash bank 1: 1024-2047)
+ *  count             - Number of elements in the view
+ *  offset (optional) - Offset of the first element in sizeof(Type) from the beginning of the page; default 0
+ * Returns the view, or an empty view if the range is out of bounds
+ */
+template <typename Type>
+FlashSpan<Type> FlashTools::getPageSpan(uint32_t page_num, uint32_t count, uint32_t offset) {
+    if (!flashPageValid(page_num)) {
+        return FlashSpan<Type>();
+    }
+    return getSpan<Type>(flashPageAddress(page_num) + offset * sizeof(Type), count);
+}
+
+/*
+ * write: Unlocks flash region and writes data to it (1 page at a time). Writes may cross from flash bank 0 into
+ * flash bank 1; each page is sent to the EFC of its bank.
+ * Pages whose staged contents already match flash are not programmed (counted in pages_skipped)
+ * With auto erase enabled, pages that only clear bits are written without erase (counted in erases_skipped)
  *  addr      - Flash address for write to occur
  *  data      - Pointer to data buffer containing data to be written
  *  data_size - Size of data buffer to be written in bytes
  *  erase     - Optional, deafult = true. Erase page before writing
  *  lock      - Optional, deafult = false. Lock page after writing
- * Returns 0 if successful or Flash Status Register error flag
+ * Returns 0 if successful, invalid code on bad arguments (including NULL data), error code if the range reaches flash
+ * bank 1 while asynchronous writes are queued, Flash Status Register error flag or TIMEOUT
  */
 template<typename Type>
 uint32_t FlashTools::write(uint32_t addr, Type *data, uint32_t data_size, bool erase = true, bool lock = false) {
     
-    /* Validate flash address then unlock flash region */
-    if (addr >= IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE || addr < IFLASH_ADDR || addr & 3) {
+    /* Validate data and flash address range then unlock flash regions */
+    if (data == NULL || addr >= IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE || addr < IFLASH_ADDR || addr & 3
+        || data_size > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - addr) {
         return INVALID;
-    } else if (islocked(addr, addr + data_size - 1) && unlock(addr, addr + data_size - 1) != SUCCESS) {
+    }
+    
+    /* Nothing to write (the end address of an empty range would be addr - 1) */
+    if (data_size == 0) {
+        return SUCCESS;
+    }
+    
+    /* With the page cache enabled, writes are absorbed in RAM. Locking and program-only (erase = false) writes go to
+       flash after any cached data for the range has been written back, since write-back always erases the page     */
+    if (cache_lines != NULL) {
+        if (!lock && erase) {
+            return cachewrite(addr, data, data_size);
+        }
+        uint32_t status {cacheevict(addr, addr + data_size - 1, true)};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    /* Flash bank 1 (EFC1 and its latch) belongs to the asynchronous queue until it is empty */
+    if (addr + data_size > IFLASH1_ADDR && asyncBusy()) {
         return ERROR;
     }
     
-    /* Determine whether addr is in flash bank 0 or 1 and set appropriate flash bank start
-       address and EFC instance (EFC0 for flash bank 0, EFC1 for flash bank 1)             */
-    const uint32_t FLASH_START_ADDR {addr >= IFLASH1_ADDR ? IFLASH1_ADDR : IFLASH0_ADDR};
-    efc = addr >= IFLASH1_ADDR ? EFC1 : EFC0;
-
-    /* Calcuate page number of addr and offset of addr from start of page */
-    uint16_t page_num {(addr - FLASH_START_ADDR) / IFLASH_PAGE_SIZE};
-    uint16_t offset   {(addr - FLASH_START_ADDR) % IFLASH_PAGE_SIZE};
-
-    /* Set wait state - 6 wait states for flash operations - datasheet pg. 303 */
-    uint32_t fws {getfws()};
-    setfws(CHIP_FLASH_WAIT_STATE);
-
+    /* Unlock flash regions (regions within an open FlashSession are already unlocked) */
+    if (islocked(addr, addr + data_size - 1) && unlock(addr, addr + data_size - 1) != SUCCESS) {
+        return ERROR;
+    }
+    
+    /* Flash bank 0 and flash bank 1 are contiguous, so pages are numbered linearly from the start of flash bank 0
+       (0-2047). Each page is routed to its bank's EFC (EFC0 for pages 0-1023, EFC1 for pages 1024-2047)      */
+    uint32_t page_num {(addr - IFLASH_ADDR) / IFLASH_PAGE_SIZE};
+    uint16_t offset   {(addr - IFLASH_ADDR) % IFLASH_PAGE_SIZE};
+    const uint8_t *src {reinterpret_cast<const uint8_t *>(data)};
+    
     /* Write all data one flash page at a time until all data has been written */
-    for (uint32_t write_size; data_size > 0; data_size -= write_size) {
+    uint32_t status {SUCCESS};
+    for (uint32_t write_size; data_size > 0 && status == SUCCESS; data_size -= write_size) {
+        
+        // Select the page's EFC (wait states are raised by cmd for each command)
+        efc = efc_bank[page_num < IFLASH_NB_OF_PAGES ? 0 : 1];
+        
+        // Page number within the bank, as expected by the EFC command argument
+        uint32_t bank_page {page_num % IFLASH_NB_OF_PAGES};
         
         // Calculate write size: (page size - offset) if >1 page needs to be written, else data_size
         write_size = IFLASH_PAGE_SIZE - offset < data_size ? IFLASH_PAGE_SIZE - offset : data_size;
         
         // Calculate page address and padding size
-        uint32_t page_address {FLASH_START_ADDR + page_num * IFLASH_PAGE_SIZE};
+        uint32_t page_address {IFLASH_ADDR + page_num * IFLASH_PAGE_SIZE};
         uint16_t padding_size {IFLASH_PAGE_SIZE - offset - write_size};
     
-        // Copy 1 page of data to flash in 3 parts: offset, data, padding
-        flashcpy(page_address, data, offset, write_size, padding_size);
-    
-        // Send EFC command. Return error flag on failure
-        if (cmd((erase && lock) ? EFC_FCMD_EWPL : (erase) ? EFC_FCMD_EWP : EFC_FCMD_WP, page_num) != SUCCESS) {
-            return efc->EEFC_FSR & EEFC_ERROR_FLAGS;
-        }
+        // Copy 1 page of data to flash in 3 parts: offset, data, padding, then send the EFC command
+        // Unchanged pages are not programmed. Stop with the error flag on failure
+        status = pagecmd(bank_page, flashcpy(pageimage(page_address), src, offset, write_size, padding_size), erase, lock);
         
         // Adjust data pointer by size of last write and pg num by 1
         // Set offset = 0 after 1st iteration
-        data += (write_size/sizeof(Type));
+        src += write_size;
         ++page_num;
         offset = 0;
     }
 
-    /* Restore flash wait state value */
-    setfws(fws);
-    return SUCCESS;
+    return status;
 }
 
 /*
@@ -384,13 +799,20 @@ uint32_t FlashTools::write(Type *addr, Type *data, uint32_t size, bool erase = t
 }
 
 /*
- * read: Reads a single chunk of data from flash
+ * read: Reads a single chunk of data from flash, or from the page cache if the page has pending writes
  *  addr - Flash address to be read
  * Returns data stored at flash address or INVALID if address is out of bounds
  */
 template <typename Type>
 Type FlashTools::read(uint32_t addr) {
-    return addr > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE || addr < IFLASH0_ADDR ? INVALID : *reinterpret_cast<Type *>(addr);
+    if (addr > IFLASH_LAST_PAGE_ADDRESS + IFLASH_PAGE_SIZE - sizeof(Type) || addr < IFLASH0_ADDR) {
+        return INVALID;
+    } else if (cache_lines != NULL) {
+        Type value;
+        cacheread(addr, &value, sizeof(Type));
+        return value;
+    }
+    return *reinterpret_cast<Type *>(addr);
 }
 
 /*
@@ -401,4 +823,27 @@ Type FlashTools::read(Type *addr) {
     return read<Type>(reinterpret_cast<uint32_t>(addr));
 }
 
+/*
+ * readArray: Reads an array of elements from flash with a single bounds check (see readBlock)
+ *  addr  - Flash address of the first element
+ *  dst   - Destination array
+ *  count - Number of elements to be read
+ * Returns 0 if successful or invalid code if the range is out of bounds
+ */
+template <typename Type>
+uint32_t FlashTools::readArray(uint32_t addr, Type *dst, uint32_t count) {
+    if (count > UINT32_MAX / sizeof(Type)) {
+        return INVALID;
+    }
+    return readBlock(addr, dst, count * sizeof(Type));
+}
+
+/*
+ * readArray: Pointer version
+ */
+template <typename Type>
+uint32_t FlashTools::readArray(const Type *addr, Type *dst, uint32_t count) {
+    return readArray<Type>(reinterpret_cast<uint32_t>(addr), dst, count);
+}
+
 #endif /* FlashTools_h */
@@ -0,0 +1,357 @@
+/* **************************************************************************************************************************************************************
+ * FlashTransaction.cpp                                                                                                                                         *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashTransaction provides power-fail-atomic multi-page writes built on FlashTools. The pages changed by a commit are written to free shadow pages, then    *
+ * a single commit record switches the logical-to-physical page map to them. A reset at any point leaves either all of the old pages or all of the new ones. *
+ * Old copies are not erased at commit time; they become free pages and are erased when reused.                                                             *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#include "FlashTransaction.h"
+
+/*
+ * Constructor: Set the page range of the transactional area. Call mount() before use.
+ *  flash_tools   - FlashTools object used for flash writes
+ *  first_page    - First flash page of the area (flash bank 0: 0-1023, flash bank 1: 1024-2047)
+ *  page_count    - Number of pages (logical_pages + 6 to 256)
+ *  logical_pages - Number of logical pages (1-FLASHTXN_MAX_PAGES)
+ */
+FlashTransaction::FlashTransaction(FlashTools &flash_tools, uint32_t first_page, uint32_t page_count, uint32_t logical_pages)
+    : flash(flash_tools), first_page(first_page), data_pages(page_count < FLASHTXN_LOG_PAGES ? 0 : page_count - FLASHTXN_LOG_PAGES),
+      logical_pages(logical_pages), log_page(0), log_used(0), txn_number(0), cursor(0), mounted(false) {
+    memset(map, FLASHTXN_NO_PAGE, sizeof(map));
+}
+
+/*
+ * mount: Recovers the page map: takes the valid log page with the higher commit number and replays its commit records.
+ * A torn commit record ends the replay; the commit it belonged to never happened, and its shadow pages are free again.
+ * Formats the area if neither log page is valid.
+ * Returns 0 if successful, invalid code on a bad page range, or Flash Status Register error flags (format)
+ */
+uint32_t FlashTransaction::mount(void) {
+    
+    if (logical_pages == 0 || logical_pages > FLASHTXN_MAX_PAGES || data_pages < logical_pages + FLASHTXN_MAX_TXN_PAGES
+        || data_pages >= FLASHTXN_NO_PAGE || !flashPageValid(first_page)
+        || data_pages + FLASHTXN_LOG_PAGES > IFLASH_TOTAL_PAGES - first_page) {
+        return INVALID;
+    }
+    
+    mounted = true;
+    
+    uint32_t number0, number1;
+    const bool VALID0 {logvalid(0, &number0)};
+    const bool VALID1 {logvalid(1, &number1)};
+    if (!VALID0 && !VALID1) {
+        return format();
+    }
+    log_page   = (VALID0 && (!VALID1 || static_cast<int32_t>(number0 - number1) > 0)) ? 0 : 1;
+    txn_number = log_page == 0 ? number0 : number1;
+    memcpy(map, reinterpret_cast<const void *>(logaddr(log_page) + FLASHTXN_LOG_HEADER), sizeof(map));
+    
+    /* Replay commit records until the first erased slot. A record that is not the next commit (torn or never completed)
+       also ends the replay; the slots after it cannot be trusted, so the next commit writes a new log page */
+    const uint32_t *record {reinterpret_cast<const uint32_t *>(logaddr(log_page) + FLASHTXN_LOG_HEADER + FLASHTXN_MAX_PAGES)};
+    for (log_used = 0; log_used < FLASHTXN_LOG_SLOTS; ++log_used, record += FLASHTXN_RECORD_SIZE / 4) {
+        
+        if ((record[0] & record[1] & record[2] & record[3]) == 0xFFFFFFFF) {
+            break;
+        }
+        
+        bool valid {record[0] == txn_number + 1 && record[3] == checksum(2166136261u, record, FLASHTXN_RECORD_SIZE - 4)};
+        const uint8_t *entry {reinterpret_cast<const uint8_t *>(&record[1])};
+        for (uint32_t i {0}; valid && i < FLASHTXN_MAX_TXN_PAGES; ++i) {
+            valid = entry[2 * i] == FLASHTXN_NO_PAGE || (entry[2 * i] < logical_pages && entry[2 * i + 1] < data_pages);
+        }
+        if (!valid) {
+            log_used = FLASHTXN_LOG_SLOTS;
+            break;
+        }
+        
+        for (uint32_t i {0}; i < FLASHTXN_MAX_TXN_PAGES; ++i) {
+            if (entry[2 * i] != FLASHTXN_NO_PAGE) {
+                map[entry[2 * i]] = entry[2 * i + 1];
+            }
+        }
+        txn_number = record[0];
+    }
+    
+    /* Start the shadow page search at a different place after every mount to spread wear */
+    cursor = (txn_number * FLASHTXN_MAX_TXN_PAGES) % data_pages;
+    return SUCCESS;
+}
+
+/*
+ * format: Erases the area and maps logical page n to data page n (all logical pages erased)
+ * Returns 0 if successful, invalid code if not mounted, or Flash Status Register error flags
+ */
+uint32_t FlashTransaction::format(void) {
+    
+    if (!mounted) {
+        return INVALID;
+    }
+    
+    /* Erase the log pages first, so an interrupted format is not mistaken for a valid area.
+       Pages that are already erased are skipped by write() */
+    uint32_t erased[IFLASH_WORDS_PER_PAGE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (uint32_t p {0}; p < FLASHTXN_LOG_PAGES + data_pages; ++p) {
+        uint32_t status {flash.write<uint32_t>(flashPageAddress(first_page + p), erased, IFLASH_PAGE_SIZE, true, false)};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    uint8_t identity[FLASHTXN_MAX_PAGES];
+    memset(identity, FLASHTXN_NO_PAGE, sizeof(identity));
+    for (uint32_t l {0}; l < logical_pages; ++l) {
+        identity[l] = l;
+    }
+    
+    log_page   = 1;
+    txn_number = 0;
+    uint32_t status {checkpoint(identity, 0)};
+    if (status != SUCCESS) {
+        return status;
+    }
+    memcpy(map, identity, sizeof(map));
+    cursor = 0;
+    return SUCCESS;
+}
+
+/*
+ * commit: Atomically writes segments to the logical pages. Each changed page is copied with its new data to a free data
+ * page (one erase and write command per page), then one commit record is programmed to the log page. Every
+ * FLASHTXN_LOG_SLOTS commits the log page is full and the commit writes the other log page instead.
+ * If power is lost before the commit record is complete, mount() recovers the contents from before the commit.
+ *  iov   - Segments; addresses are logical (0 to logical_pages * IFLASH_PAGE_SIZE - 1)
+ *  count - Number of segments (at least 1; the segments may change at most FLASHTXN_MAX_TXN_PAGES pages)
+ * Returns 0 if successful, invalid code on bad arguments, or Flash Status Register error flags (nothing is committed)
+ */
+uint32_t FlashTransaction::commit(const FlashIovec *iov, uint32_t count) {
+    
+    if (!mounted || iov == NULL || count == 0) {
+        return INVALID;
+    }
+    
+    /* Collect the logical pages changed by the segments */
+    const uint32_t LIMIT {logical_pages * IFLASH_PAGE_SIZE};
+    uint8_t pages[FLASHTXN_MAX_TXN_PAGES];
+    uint32_t touched {0};
+    for (uint32_t s {0}; s < count; ++s) {
+        
+        if (iov[s].data == NULL || iov[s].size == 0 || iov[s].addr >= LIMIT || iov[s].size > LIMIT - iov[s].addr) {
+            return INVALID;
+        }
+        
+        for (uint32_t l {iov[s].addr / IFLASH_PAGE_SIZE}; l <= (iov[s].addr + iov[s].size - 1) / IFLASH_PAGE_SIZE; ++l) {
+            uint32_t i {0};
+            while (i < touched && pages[i] != l) {
+                ++i;
+            }
+            if (i == touched) {
+                if (touched == FLASHTXN_MAX_TXN_PAGES) {
+                    return INVALID;
+                }
+                pages[touched++] = l;
+            }
+        }
+    }
+    
+    /* Pick free data pages for the shadow copies. Pages of the current map (including the copies being replaced)
+       are in use; there are always at least FLASHTXN_MAX_TXN_PAGES others */
+    uint32_t in_use[(FLASHTXN_NO_PAGE + 31) / 32];
+    memset(in_use, 0, sizeof(in_use));
+    for (uint32_t l {0}; l < logical_pages; ++l) {
+        in_use[map[l] / 32] |= 1u << (map[l] % 32);
+    }
+    uint8_t shadow[FLASHTXN_MAX_TXN_PAGES];
+    for (uint32_t i {0}; i < touched; ++i) {
+        while (in_use[cursor / 32] & (1u << (cursor % 32))) {
+            cursor = (cursor + 1) % data_pages;
+        }
+        shadow[i] = cursor;
+        in_use[cursor / 32] |= 1u << (cursor % 32);
+        cursor = (cursor + 1) % data_pages;
+    }
+    
+    /* Stage: current contents of each page with the segments applied, written to its shadow page */
+    uint32_t buffer[IFLASH_WORDS_PER_PAGE];
+    for (uint32_t i {0}; i < touched; ++i) {
+        
+        const uint32_t PAGE_START {pages[i] * IFLASH_PAGE_SIZE};
+        memcpy(buffer, reinterpret_cast<const void *>(dataaddr(map[pages[i]])), IFLASH_PAGE_SIZE);
+        
+        for (uint32_t s {0}; s < count; ++s) {
+            const uint32_t START {iov[s].addr > PAGE_START ? iov[s].addr : PAGE_START};
+            const uint32_t END   {iov[s].addr + iov[s].size < PAGE_START + IFLASH_PAGE_SIZE ? iov[s].addr + iov[s].size : PAGE_START + IFLASH_PAGE_SIZE};
+            if (START < END) {
+                memcpy(reinterpret_cast<uint8_t *>(buffer) + (START - PAGE_START),
+                       reinterpret_cast<const uint8_t *>(iov[s].data) + (START - iov[s].addr), END - START);
+            }
+        }
+        
+        uint32_t status {flash.write<uint32_t>(dataaddr(shadow[i]), buffer, IFLASH_PAGE_SIZE, true, false)};
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    
+    uint8_t new_map[FLASHTXN_MAX_PAGES];
+    memcpy(new_map, map, sizeof(new_map));
+    for (uint32_t i {0}; i < touched; ++i) {
+        new_map[pages[i]] = shadow[i];
+    }
+    
+    /* Commit: program one record (number, (logical page, data page) pairs, checksum), or write the other log page */
+    uint32_t status;
+    if (log_used < FLASHTXN_LOG_SLOTS) {
+        
+        uint32_t record[FLASHTXN_RECORD_SIZE / 4];
+        memset(record, 0xFF, sizeof(record));
+        record[0] = txn_number + 1;
+        uint8_t *entry {reinterpret_cast<uint8_t *>(&record[1])};
+        for (uint32_t i {0}; i < touched; ++i) {
+            entry[2 * i]     = pages[i];
+            entry[2 * i + 1] = shadow[i];
+        }
+        record[3] = checksum(2166136261u, record, FLASHTXN_RECORD_SIZE - 4);
+        
+        status = flash.write<uint32_t>(logaddr(log_page) + FLASHTXN_LOG_HEADER + FLASHTXN_MAX_PAGES + log_used * FLASHTXN_RECORD_SIZE,
+                                       record, FLASHTXN_RECORD_SIZE, false, false);
+        
+        /* The slot is used even if programming failed; a partly programmed slot ends the replay on mount,
+           so the next commit writes a new log page */
+        log_used = status == SUCCESS ? log_used + 1 : FLASHTXN_LOG_SLOTS;
+    } else {
+        status = checkpoint(new_map, txn_number + 1);
+    }
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    memcpy(map, new_map, sizeof(map));
+    ++txn_number;
+    return SUCCESS;
+}
+
+/*
+ * read: Copies data from the logical pages
+ *  addr - Logical address (0 to logical_pages * IFLASH_PAGE_SIZE - 1)
+ *  dst  - Destination buffer
+ *  size - Number of bytes
+ * Returns 0 if successful or invalid code on bad arguments
+ */
+uint32_t FlashTransaction::read(uint32_t addr, void *dst, uint32_t size) {
+    
+    const uint32_t LIMIT {logical_pages * IFLASH_PAGE_SIZE};
+    if (!mounted || dst == NULL || addr >= LIMIT || size > LIMIT - addr) {
+        return INVALID;
+    }
+    
+    uint8_t *out {reinterpret_cast<uint8_t *>(dst)};
+    while (size > 0) {
+        const uint32_t OFFSET {addr % IFLASH_PAGE_SIZE};
+        const uint32_t CHUNK  {size < IFLASH_PAGE_SIZE - OFFSET ? size : IFLASH_PAGE_SIZE - OFFSET};
+        uint32_t status {flash.readBlock(dataaddr(map[addr / IFLASH_PAGE_SIZE]) + OFFSET, out, CHUNK)};
+        if (status != SUCCESS) {
+            return status;
+        }
+        addr += CHUNK;
+        out  += CHUNK;
+        size -= CHUNK;
+    }
+    return SUCCESS;
+}
+
+/*
+ * page: Gets a pointer to the current copy of a logical page in flash (no copy). It is valid until the next commit
+ * that changes the page. Returns NULL on a bad page number
+ */
+const void *FlashTransaction::page(uint32_t logical_page) {
+    
+    if (!mounted || logical_page >= logical_pages) {
+        return NULL;
+    }
+    return reinterpret_cast<const void *>(dataaddr(map[logical_page]));
+}
+
+/*
+ * commits: Gets the number of the last commit (0 after format)
+ */
+uint32_t FlashTransaction::commits(void) {
+    return txn_number;
+}
+
+/*
+ * logaddr: Gets the flash address of a log page
+ */
+uint32_t FlashTransaction::logaddr(uint32_t log_idx) {
+    return flashPageAddress(first_page + log_idx);
+}
+
+/*
+ * dataaddr: Gets the flash address of a data page
+ */
+uint32_t FlashTransaction::dataaddr(uint32_t data_idx) {
+    return flashPageAddress(first_page + FLASHTXN_LOG_PAGES + data_idx);
+}
+
+/*
+ * checkpoint: Writes the log page not in use with commit number number and new_map, and no records (one erase and
+ * write command). The old log page stays valid until the new one is complete.
+ * Returns 0 if successful or Flash Status Register error flags
+ */
+uint32_t FlashTransaction::checkpoint(const uint8_t *new_map, uint32_t number) {
+    
+    uint32_t buffer[IFLASH_WORDS_PER_PAGE];
+    memset(buffer, 0xFF, sizeof(buffer));
+    buffer[0] = FLASHTXN_MAGIC;
+    buffer[1] = number;
+    memcpy(&buffer[FLASHTXN_LOG_HEADER / 4], new_map, FLASHTXN_MAX_PAGES);
+    buffer[2] = checksum(checksum(2166136261u, &buffer[1], 4), new_map, FLASHTXN_MAX_PAGES);
+    
+    const uint32_t TARGET {log_page ^ 1};
+    uint32_t status {flash.write<uint32_t>(logaddr(TARGET), buffer, IFLASH_PAGE_SIZE, true, false)};
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    log_page = TARGET;
+    log_used = 0;
+    return SUCCESS;
+}
+
+/*
+ * logvalid: Checks the header and map checksum of a log page and gets the commit number it was written with
+ */
+bool FlashTransaction::logvalid(uint32_t log_idx, uint32_t *number) {
+    
+    const uint32_t *header {reinterpret_cast<const uint32_t *>(logaddr(log_idx))};
+    const uint8_t *log_map {reinterpret_cast<const uint8_t *>(logaddr(log_idx) + FLASHTXN_LOG_HEADER)};
+    *number = header[1];
+    
+    if (header[0] != FLASHTXN_MAGIC || header[2] != checksum(checksum(2166136261u, &header[1], 4), log_map, FLASHTXN_MAX_PAGES)) {
+        return false;
+    }
+    for (uint32_t l {0}; l < logical_pages; ++l) {
+        if (log_map[l] >= data_pages) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * checksum: FNV-1a hash of data, continuing from seed
+ */
+uint32_t FlashTransaction::checksum(uint32_t seed, const void *data, uint32_t size) {
+    
+    uint32_t sum {seed};
+    const uint8_t *byte {reinterpret_cast<const uint8_t *>(data)};
+    for (uint32_t i {0}; i < size; ++i) {
+        sum = (sum ^ byte[i]) * 16777619u;
+    }
+    return sum;
+}
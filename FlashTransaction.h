@@ -0,0 +1,89 @@
+/* **************************************************************************************************************************************************************
+ * FlashTransaction.h                                                                                                                                           *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * FlashTransaction provides power-fail-atomic multi-page writes built on FlashTools. The pages changed by a commit are written to free shadow pages, then    *
+ * a single commit record switches the logical-to-physical page map to them. A reset at any point leaves either all of the old pages or all of the new ones. *
+ * Old copies are not erased at commit time; they become free pages and are erased when reused.                                                             *
+ *                                                                                                                                                              *
+ * **************************************************************************************************************************************************************/
+
+#ifndef FlashTransaction_h
+#define FlashTransaction_h
+
+#include "FlashTools.h"
+
+/* ---------------- FlashTransaction Definitions ---------------- */
+#define FLASHTXN_MAX_PAGES      (64u)                                           /* Logical pages at most */
+#define FLASHTXN_MAX_TXN_PAGES  (4u)                                            /* Pages changed by one commit at most */
+#define FLASHTXN_LOG_PAGES      (2u)                                            /* Commit log pages (used alternately) */
+#define FLASHTXN_MAGIC          (0x4E585431u)                                   /* Log page header magic ("1TXN") */
+#define FLASHTXN_LOG_HEADER     (16u)                                           /* Log page header: magic, commit number, checksum, reserved */
+#define FLASHTXN_RECORD_SIZE    (16u)                                           /* Commit record: number, 4 page entries, checksum */
+#define FLASHTXN_LOG_SLOTS      ((IFLASH_PAGE_SIZE - FLASHTXN_LOG_HEADER - FLASHTXN_MAX_PAGES) / FLASHTXN_RECORD_SIZE)   /* Records per log page */
+#define FLASHTXN_NO_PAGE        (0xFFu)                                         /* Unused map / record entry */
+
+/* ---------------- FlashTransaction Class ---------------- */
+/* Page range layout: 2 log pages, then data pages (at most 254). A log page holds a header, a snapshot of the page
+   map (one data page index per logical page) and commit records appended with program-only writes. A record lists up
+   to 4 (logical page, data page) pairs and a checksum; a record torn by a reset fails its checksum and is ignored.
+   When the log page is full, the commit is made instead by writing the other log page with the commit number and the
+   updated map (one erase and write command). Mount takes the valid log page with the higher commit number and replays
+   its records, so recovery reads at most 2 headers and 11 records.
+   Reads go directly to flash; do not enable the FlashTools page cache over the page range.                      */
+class FlashTransaction {
+    
+    private:
+        FlashTools &flash;
+    
+        /* Page range: first page, number of data pages and logical pages */
+        uint32_t first_page;
+        uint32_t data_pages;
+        uint32_t logical_pages;
+    
+        /* Page map (data page index of each logical page), current log page (0 or 1), used record slots,
+           number of the last commit and next data page to try for a shadow copy */
+        uint8_t map[FLASHTXN_MAX_PAGES];
+        uint32_t log_page;
+        uint32_t log_used;
+        uint32_t txn_number;
+        uint32_t cursor;
+        bool mounted;
+    
+        /* Flash address of a log page / of a data page */
+        uint32_t logaddr(uint32_t log_idx);
+        uint32_t dataaddr(uint32_t data_idx);
+    
+        /* Write the other log page with a commit number and map / check a log page and get its commit number */
+        uint32_t checkpoint(const uint8_t *new_map, uint32_t number);
+        bool logvalid(uint32_t log_idx, uint32_t *number);
+    
+        /* Checksums of a log page header and of a commit record */
+        static uint32_t checksum(uint32_t seed, const void *data, uint32_t size);
+    
+        /* Transactions cannot be copied */
+        FlashTransaction(const FlashTransaction &);
+        FlashTransaction &operator=(const FlashTransaction &);
+    
+    public:
+        /* Create a transactional area over page_count pages starting at first_page (0-2047) holding logical_pages pages.
+           page_count must be at least logical_pages + 2 (log) + 4 (shadow pages for the largest commit) */
+        FlashTransaction(FlashTools &flash_tools, uint32_t first_page, uint32_t page_count, uint32_t logical_pages);
+    
+        /* Recover the page map from the commit log (formats the area if it holds none) / erase the area */
+        uint32_t mount(void);
+        uint32_t format(void);
+    
+        /* Atomically write segments (addresses are logical: 0 .. logical_pages * IFLASH_PAGE_SIZE - 1) */
+        uint32_t commit(const FlashIovec *iov, uint32_t count);
+    
+        /* Read logical address range / get the flash address of a logical page's current copy */
+        uint32_t read(uint32_t addr, void *dst, uint32_t size);
+        const void *page(uint32_t logical_page);
+    
+        /* Number of the last commit */
+        uint32_t commits(void);
+};
+
+#endif /* FlashTransaction_h */
@@ -0,0 +1,35 @@
+/* **************************************************************************************************************************************************************
+ * Arduino.h                                                                                                                                                    *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * Minimal stand-in for the Arduino Due core, so FlashTools can be compiled and tested on a host (see write_test.cpp).                                          *
+ * ************************************************************************************************************************************************************ */
+
+#ifndef _ARDUINO_HOST_STUB_H
+#define _ARDUINO_HOST_STUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Core clock and time base (defined by the test) */
+extern uint32_t SystemCoreClock;
+unsigned long millis(void);
+unsigned long micros(void);
+
+/* CMSIS intrinsics */
+static inline void __DSB(void) {}
+static inline void __ISB(void) {}
+static inline void __DMB(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t) {}
+static inline void __disable_irq(void) {}
+static inline uint32_t __CLZ(uint32_t x) { return x ? __builtin_clz(x) : 32; }
+
+/* NVIC */
+typedef enum { EFC0_IRQn = 6, EFC1_IRQn = 7 } IRQn_Type;
+static inline void NVIC_EnableIRQ(IRQn_Type) {}
+static inline void NVIC_SetPendingIRQ(IRQn_Type) {}
+
+#endif
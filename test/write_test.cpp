@@ -0,0 +1,98 @@
+/* **************************************************************************************************************************************************************
+ * write_test.cpp                                                                                                                                               *
+ * Created by Dave Dorzback                                                                                                                                     *
+ * Copyright (C) Dave Dorzback                                                                                                                                  *
+ *                                                                                                                                                              *
+ * Host test for the unchanged page skip in FlashTools::write() and FlashTools::writev(). FlashTools drives two RAM models of the EFC register blocks and a   *
+ * RAM image of both flash banks, and the test checks the write statistics and the commands written to each Flash Command Register.                            *
+ *                                                                                                                                                              *
+ * Build and run from the library folder:                                                                                                                       *
+ *   g++ -std=gnu++11 -fpermissive -w -I test -I . test/write_test.cpp FlashTools.cpp -o write_test && ./write_test                                             *
+ * ************************************************************************************************************************************************************ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "FlashTools.h"
+
+uint32_t SystemCoreClock {84000000};
+unsigned long millis(void) { return 0; }
+unsigned long micros(void) { return 0; }
+
+/* EFC register block models (FMR, FCR, FSR, FRR): always ready, no lock bits set */
+static uint32_t efc_regs[2][4];
+static uint8_t *flash;
+
+static uint32_t failures {0};
+
+/* Report a failed check */
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+/* Command written to an EFC model's Flash Command Register since the last call (0 if none), then clear it */
+static uint32_t takefcr(uint32_t bank) {
+    uint32_t fcr {efc_regs[bank][1]};
+    efc_regs[bank][1] = 0;
+    return fcr;
+}
+
+/* Expected Flash Command Register value */
+static uint32_t fcr(uint32_t fcmd, uint32_t farg) {
+    return (FWP_KEY << 24) | (farg << 8) | fcmd;
+}
+
+int main(void) {
+    
+    flash = static_cast<uint8_t *>(malloc(2 * IFLASH_NB_OF_PAGES * IFLASH_PAGE_SIZE));
+    memset(flash, 0xFF, 2 * IFLASH_NB_OF_PAGES * IFLASH_PAGE_SIZE);
+    efc_regs[0][2] = efc_regs[1][2] = EEFC_FSR_FRDY;
+    
+    FlashTools ft(reinterpret_cast<EfcInstance *>(efc_regs[0]), reinterpret_cast<EfcInstance *>(efc_regs[1]), flash);
+    
+    uint8_t data[2 * IFLASH_PAGE_SIZE];
+    for (uint32_t i {0}; i < sizeof(data); ++i) {
+        data[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+    
+    /* A new page in flash bank 1 is programmed through EFC1 with its page number in the bank */
+    const uint32_t ADDR1 {flashPageAddress(IFLASH_NB_OF_PAGES + 3)};
+    check(ft.write(ADDR1, data, IFLASH_PAGE_SIZE) == SUCCESS, "bank 1 write");
+    check(ft.getWriteStats().pages_programmed == 1 && ft.getWriteStats().pages_skipped == 0, "bank 1 write programs one page");
+    check(takefcr(1) == fcr(EFC_FCMD_EWP, 3), "bank 1 write sends EWP for page 3 to EFC1");
+    check(memcmp(flash + (ADDR1 - IFLASH_ADDR), data, IFLASH_PAGE_SIZE) == 0, "bank 1 page image holds the data");
+    takefcr(0);
+    
+    /* Writing the same data again is skipped without any command */
+    ft.clearWriteStats();
+    check(ft.write(ADDR1, data, IFLASH_PAGE_SIZE) == SUCCESS, "bank 1 rewrite");
+    check(ft.getWriteStats().pages_programmed == 0 && ft.getWriteStats().pages_skipped == 1, "bank 1 rewrite skips one page");
+    check(takefcr(0) == 0 && takefcr(1) == 0, "bank 1 rewrite sends no command");
+    
+    /* Two pages in flash bank 0, then a rewrite of both where only the second page changes */
+    const uint32_t ADDR0 {flashPageAddress(10)};
+    ft.clearWriteStats();
+    check(ft.write(ADDR0, data, sizeof(data)) == SUCCESS, "bank 0 write");
+    check(ft.getWriteStats().pages_programmed == 2 && ft.getWriteStats().pages_skipped == 0, "bank 0 write programs two pages");
+    takefcr(0);
+    
+    ft.clearWriteStats();
+    data[IFLASH_PAGE_SIZE + 5] ^= 0xFF;
+    check(ft.write(ADDR0, data, sizeof(data)) == SUCCESS, "bank 0 rewrite");
+    check(ft.getWriteStats().pages_programmed == 1 && ft.getWriteStats().pages_skipped == 1, "bank 0 rewrite skips the unchanged page");
+    check(takefcr(0) == fcr(EFC_FCMD_EWP, 11) && takefcr(1) == 0, "bank 0 rewrite sends EWP for page 11 to EFC0 only");
+    
+    /* Scatter-gather write of unchanged segments is skipped as well */
+    FlashIovec iov[2] {{ADDR0 + 16, data + 16, 32}, {ADDR1 + 64, data + 64, 64}};
+    ft.clearWriteStats();
+    check(ft.writev(iov, 2) == SUCCESS, "writev");
+    check(ft.getWriteStats().pages_programmed == 0 && ft.getWriteStats().pages_skipped == 2, "writev skips both unchanged pages");
+    check(takefcr(0) == 0 && takefcr(1) == 0, "writev sends no command");
+    
+    free(flash);
+    
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}